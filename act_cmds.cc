@@ -359,6 +359,8 @@ static int process_set_top (int argc, char **argv)
 					u);
 
 	if (F.cell_map || F.ckt_gen) {
+	  ckt_buffer_batch_abort ();
+	  ckt_caches_clear ();
 	  if (F.cell_map) {
 	    ActCellPass *cp =
 	      dynamic_cast<ActCellPass *>(F.act_design->pass_find ("prs2cells"));
@@ -46,6 +46,24 @@ void act_emit_verilog (Act *a, FILE *fp, Process *p);
 void save_to_log (int argc, char **argv, const char *fmt);
 
 ActNetlistPass *getNetlistPass (void);
+void ckt_caches_clear (void);
+void ckt_buffer_batch_abort (void);
+
+#ifdef FOUND_timing_actpin
+
+/* -- timer interface used by the circuit editing commands -- */
+struct timer_slew_info {
+  char *net;			/* net name */
+  double slew;			/* worst of rise/fall slew, in timer units */
+};
+list_t *timer_slew_violations (double limit);
+int timer_retime (void);
+void timer_netlist_changed (void);
+int timer_whatif_active (void);
+double timer_worst_fork_slack (void);
+list_t *timer_fork_drivers (double target);
+
+#endif
 
 #ifdef FOUND_galois
 
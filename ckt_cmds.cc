@@ -20,7 +20,16 @@
  **************************************************************************
  */
 #include <stdio.h>
+#include <math.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include <act/passes.h>
+#include <act/iter.h>
+#include <common/hash.h>
+#include <common/array.h>
+#include <common/misc.h>
+#include <common/mytime.h>
 #include <lispCli.h>
 #include "all_cmds.h"
 #include "flow.h"
@@ -123,12 +132,27 @@ int process_ckt_save_flatsp (int argc, char **argv)
     return LISP_RET_ERROR;
   }
   
-  fp = std_open_output (argv[0], argv[1]);
+  fp = std_open_stream (argv[0], argv[1]);
   if (!fp) {
+    fprintf (stderr, "%s: could not open file `%s' for writing\n",
+	     argv[0], argv[1]);
     return LISP_RET_ERROR;
   }
+
+  double r_time = realtime_msec ();
   np->printFlat (fp);
-  std_close_output (fp);
+  long sz = (fp == stdout) ? 0 : ftell (fp);
+
+  if (!std_close_stream (fp, 1)) {
+    if (!LispInterruptExecution) {
+      fprintf (stderr, "%s: error writing `%s'\n", argv[0], argv[1]);
+    }
+    return LISP_RET_ERROR;
+  }
+  if (fp != stdout) {
+    printf ("%s: wrote %.1f MB in %.3f s\n", argv[0], sz/1048576.0,
+	    (realtime_msec () - r_time)/1000.0);
+  }
   return LISP_RET_TRUE;
 }
 
@@ -216,11 +240,172 @@ static int process_ckt_save_sim (int argc, char **argv)
   return LISP_RET_TRUE;
 }
 
+/*
+ * Turn a module name into a file name
+ */
+static void _module_file_name (char *buf, int sz, const char *dir,
+			       const char *mod, struct Hashtable *H)
+{
+  char *tmp = Strdup (mod);
+  for (char *t = tmp; *t; t++) {
+    if (!isalnum (*t) && *t != '_' && *t != '-' && *t != '.') {
+      *t = '_';
+    }
+  }
+  snprintf (buf, sz, "%s/%s.v", dir, tmp);
+  for (int i=1; hash_lookup (H, buf); i++) {
+    snprintf (buf, sz, "%s/%s_%d.v", dir, tmp, i);
+  }
+  hash_add (H, buf);
+  FREE (tmp);
+}
+
+/*
+ * Split Verilog text into one file per module in <dir>, and write the
+ * list of files in the order they were emitted to <dir>/modules.f.
+ * Text between modules is kept with the module that follows it; any
+ * text other than white space after the last module is an error.
+ *
+ * act_emit_verilog emits the whole hierarchy in one call, with no
+ * per-module entry point, so its output is split here.
+ */
+static int _split_verilog (const char *cmd, FILE *vfp, const char *dir)
+{
+  FILE *mfp, *out;
+  char *line = NULL;
+  size_t linesz = 0;
+  char fname[10240];
+  int nmod = 0;
+
+  if (mkdir (dir, 0777) != 0 && errno != EEXIST) {
+    fprintf (stderr, "%s: could not create directory `%s'\n", cmd, dir);
+    return -1;
+  }
+  snprintf (fname, 10240, "%s/modules.f", dir);
+  mfp = std_open_stream (cmd, fname);
+  if (!mfp) {
+    fprintf (stderr, "%s: could not open file `%s' for writing\n", cmd, fname);
+    return -1;
+  }
+
+  FILE *pending = tmpfile ();
+  int npending = 0;		/* non-blank characters in pending */
+  if (!pending) {
+    fprintf (stderr, "%s: could not create a temporary file\n", cmd);
+    std_close_stream (mfp, 0);
+    return -1;
+  }
+
+  struct Hashtable *H = hash_new (32);
+  int err = 0;
+  out = NULL;
+  rewind (vfp);
+  while (getline (&line, &linesz, vfp) != -1) {
+    char *t = line;
+    while (*t == ' ' || *t == '\t') t++;
+
+    if (LispInterruptExecution) {
+      fprintf (stderr, "%s: interrupted\n", cmd);
+      err = 1;
+      break;
+    }
+
+    if (!out && strncmp (t, "module", 6) == 0 && isspace (t[6])) {
+      char *nm = t + 6;
+      while (isspace (*nm)) nm++;
+      char *e = nm;
+      while (*e && !isspace (*e) && (*nm == '\\' || (*e != '(' && *e != ';'))) {
+	e++;
+      }
+      char c = *e;
+      *e = '\0';
+      _module_file_name (fname, 10240, dir, nm, H);
+      *e = c;
+
+      out = std_open_stream (cmd, fname);
+      if (!out) {
+	fprintf (stderr, "%s: could not open file `%s' for writing\n",
+		 cmd, fname);
+	err = 1;
+	break;
+      }
+      fprintf (mfp, "%s\n", fname);
+      nmod++;
+
+      /* -- comments etc. emitted before the module -- */
+      rewind (pending);
+      int ch;
+      while ((ch = fgetc (pending)) != EOF) {
+	fputc (ch, out);
+      }
+      fclose (pending);
+      pending = tmpfile ();
+      npending = 0;
+      if (!pending) {
+	fprintf (stderr, "%s: could not create a temporary file\n", cmd);
+	err = 1;
+	break;
+      }
+    }
+
+    fputs (line, out ? out : pending);
+    if (!out && *t && !isspace (*t)) {
+      npending++;
+    }
+
+    if (out && strncmp (t, "endmodule", 9) == 0) {
+      int ok = std_close_stream (out, 1);
+      out = NULL;
+      if (!ok) {
+	fprintf (stderr, "%s: error writing `%s'\n", cmd, fname);
+	err = 1;
+	break;
+      }
+    }
+  }
+  if (!err && (out || npending > 0)) {
+    fprintf (stderr, "%s: Verilog output does not end with a complete module\n",
+	     cmd);
+    err = 1;
+  }
+  if (out && !std_close_stream (out, !err) && !err) {
+    fprintf (stderr, "%s: error writing `%s'\n", cmd, fname);
+    err = 1;
+  }
+  if (pending) {
+    fclose (pending);
+  }
+  if (line) {
+    free (line);
+  }
+  hash_free (H);
+  if (!std_close_stream (mfp, !err) && !err) {
+    fprintf (stderr, "%s: error writing `%s/modules.f'\n", cmd, dir);
+    err = 1;
+  }
+  return err ? -1 : nmod;
+}
+
 static int process_ckt_save_v (int argc, char **argv)
 {
   FILE *fp;
+  int emit_cells = 1;
+  int split = 0;
+  int i;
 
-  if (!std_argcheck ((argc == 3 ? 2 : argc), argv, 2, "[-nocell] <file>", STATE_EXPANDED)) {
+  for (i=1; i < argc-1; i++) {
+    if (strcmp (argv[i], "-nocell") == 0) {
+      emit_cells = 0;
+    }
+    else if (strcmp (argv[i], "-split") == 0) {
+      split = 1;
+    }
+    else {
+      break;
+    }
+  }
+  if (!std_argcheck ((i == argc-1 ? 2 : 1), argv, 2,
+		     "[-nocell] [-split] <file|dir>", STATE_EXPANDED)) {
     return LISP_RET_ERROR;
   }
   save_to_log (argc, argv, "s*");
@@ -230,32 +415,424 @@ static int process_ckt_save_v (int argc, char **argv)
     return LISP_RET_ERROR;
   }
 
-  if (argc == 3) {
-    if (strcmp (argv[1], "-nocell") != 0) {
-      fprintf (stderr, "%s: only -nocell is a supported argument", argv[0]);
-      return LISP_RET_ERROR;
-    }
-    else {
-      config_set_int ("act2v.emit_cells", 0);
-    }
+  config_set_int ("act2v.emit_cells", emit_cells);
+
+  if (split) {
+    fp = tmpfile ();
   }
   else {
-    config_set_int ("act2v.emit_cells", 1);
+    fp = std_open_stream (argv[0], argv[argc-1]);
   }
-
-  fp = std_open_output (argv[0], argv[argc-1]);
   if (!fp) {
+    fprintf (stderr, "%s: could not open output for writing\n", argv[0]);
     return LISP_RET_ERROR;
   }
   
   act_emit_verilog (F.act_design, fp, F.act_toplevel);
-  
-  fclose (fp);
+
+  if (split) {
+    int n = _split_verilog (argv[0], fp, argv[argc-1]);
+    fclose (fp);
+    if (n < 0) {
+      return LISP_RET_ERROR;
+    }
+    LispSetReturnInt (n);
+    return LISP_RET_INT;
+  }
+  if (!std_close_stream (fp, 1)) {
+    if (!LispInterruptExecution) {
+      fprintf (stderr, "%s: error writing `%s'\n", argv[0], argv[argc-1]);
+    }
+    return LISP_RET_ERROR;
+  }
   
   return LISP_RET_TRUE;
 }
 
 
+/*************************************************************************
+ *
+ *  Design statistics
+ *
+ *************************************************************************
+ */
+
+/*
+ * Area of a cell from its LEF macro. Returns 0 if PhyDB is not loaded
+ * or has no macro for the cell.
+ */
+static int _lef_area (Process *p, double *area)
+{
+#ifdef FOUND_phydb
+  if (F.phydb) {
+    char buf[10240];
+    F.act_design->msnprintfproc (buf, 10240, p);
+    phydb::Macro *m = F.phydb->GetMacroPtr (std::string (buf));
+    if (m) {
+      *area = m->GetWidth()*m->GetHeight();
+      return 1;
+    }
+  }
+#endif
+  return 0;
+}
+
+/*
+ * Area of a cell: the LEF macro if <lef> is set (callers check that
+ * PhyDB has one), otherwise the total transistor W*L from the netlist
+ * (in grid units).
+ */
+static double _cell_area (Process *p, int lef)
+{
+  double area;
+
+  if (lef) {
+    return _lef_area (p, &area) ? area : 0.0;
+  }
+  ActNetlistPass *np = getNetlistPass ();
+  if (!np || !np->completed()) {
+    return 0.0;
+  }
+  netlist_t *N = np->getNL (p);
+  if (!N) {
+    return 0.0;
+  }
+  area = 0.0;
+  for (node_t *n = N->hd; n; n = n->next) {
+    listitem_t *li;
+    for (li = list_first (n->e); li; li = list_next (li)) {
+      edge_t *e = (edge_t *) list_value (li);
+      if (e->a == n) {
+	area += (double)e->w*e->l;
+      }
+    }
+  }
+  return area;
+}
+
+#define STATS_FO_BUCKETS 8	/* pins/net: 1,2,3,4,5-8,9-16,17-32,33+ */
+
+struct ckt_type_child {
+  Process *p;
+  int count;
+};
+
+/*
+ * Per-type statistics. The local fields cover only the type itself;
+ * the totals include everything instantiated below it.
+ */
+struct ckt_type_stats {
+  Process *p;
+  A_DECL (ckt_type_child, ch);	/* process instances, with counts */
+
+  int fets;			/* local transistors */
+  double w, l;			/* local total W and L (lambda) */
+
+  double insts;			/* total process instances below */
+  double cells;			/* total cell instances below */
+  double tfets;			/* total transistors */
+  double tw, tl;		/* total W and L */
+  double area;			/* total LEF area */
+  double fo[STATS_FO_BUCKETS];	/* total pins-per-net histogram */
+
+  double occ;			/* occurrences in the design */
+};
+
+static struct pHashtable *stats_cache = NULL;
+static A_DECL (ckt_type_stats *, stats_order); /* children first */
+
+static void _stats_clear (void)
+{
+  if (!stats_cache) {
+    return;
+  }
+  for (int i=0; i < A_LEN (stats_order); i++) {
+    A_FREE (stats_order[i]->ch);
+    FREE (stats_order[i]);
+  }
+  A_FREE (stats_order);
+  phash_free (stats_cache);
+  stats_cache = NULL;
+}
+
+static int _fo_bucket (int n)
+{
+  if (n <= 4) {
+    return n < 1 ? 0 : n - 1;
+  }
+  if (n <= 8) return 4;
+  if (n <= 16) return 5;
+  if (n <= 32) return 6;
+  return 7;
+}
+
+/*
+ * Compute (or return the cached) statistics for process <p>
+ */
+static ckt_type_stats *_type_stats (ActNetlistPass *np,
+				    ActBooleanizePass *bp, Process *p)
+{
+  phash_bucket_t *b;
+  ckt_type_stats *ts;
+
+  b = phash_lookup (stats_cache, p);
+  if (b) {
+    return (ckt_type_stats *) b->v;
+  }
+
+  NEW (ts, ckt_type_stats);
+  ts->p = p;
+  A_INIT (ts->ch);
+  ts->fets = 0;
+  ts->w = 0;
+  ts->l = 0;
+  ts->occ = 0;
+  for (int i=0; i < STATS_FO_BUCKETS; i++) {
+    ts->fo[i] = 0;
+  }
+  b = phash_add (stats_cache, p);
+  b->v = ts;
+
+  /* -- local transistors -- */
+  netlist_t *N = np->getNL (p);
+  if (N) {
+    for (node_t *n = N->hd; n; n = n->next) {
+      for (listitem_t *li = list_first (n->e); li; li = list_next (li)) {
+	edge_t *e = (edge_t *) list_value (li);
+	if (e->a == n) {
+	  ts->fets++;
+	  ts->w += (double)e->w/ActNetlistPass::getGridsPerLambda();
+	  ts->l += (double)e->l/ActNetlistPass::getGridsPerLambda();
+	}
+      }
+    }
+  }
+
+  /* -- local nets, if ckt:mk-nets has been run -- */
+  act_boolean_netlist_t *bnl = bp ? bp->getBNL (p) : NULL;
+  if (bnl) {
+    for (int i=0; i < A_LEN (bnl->nets); i++) {
+      if (bnl->nets[i].skip) continue;
+      ts->fo[_fo_bucket (A_LEN (bnl->nets[i].pins))] += 1;
+    }
+  }
+
+  ts->insts = 0;
+  ts->cells = 0;
+  ts->tfets = ts->fets;
+  ts->tw = ts->w;
+  ts->tl = ts->l;
+  if (!p->isCell() || !_lef_area (p, &ts->area)) {
+    ts->area = 0;
+  }
+
+  /* -- roll up the instances -- */
+  ActInstiter it(p->CurScope());
+  for (it = it.begin(); it != it.end(); it++) {
+    ValueIdx *vx = (*it);
+    if (!TypeFactory::isProcessType (vx->t)) continue;
+    Process *cp = dynamic_cast<Process *> (vx->t->BaseType());
+    if (!cp) continue;
+
+    int count = vx->t->arrayInfo() ? vx->t->arrayInfo()->size() : 1;
+    ckt_type_stats *cs = _type_stats (np, bp, cp);
+
+    A_NEW (ts->ch, ckt_type_child);
+    A_NEXT (ts->ch).p = cp;
+    A_NEXT (ts->ch).count = count;
+    A_INC (ts->ch);
+
+    ts->insts += count*(1 + cs->insts);
+    ts->cells += count*((cp->isCell() ? 1 : 0) + cs->cells);
+    ts->tfets += count*cs->tfets;
+    ts->tw += count*cs->tw;
+    ts->tl += count*cs->tl;
+    if (!p->isCell()) {
+      ts->area += count*cs->area;
+    }
+    for (int i=0; i < STATS_FO_BUCKETS; i++) {
+      ts->fo[i] += count*cs->fo[i];
+    }
+  }
+
+  A_NEW (stats_order, ckt_type_stats *);
+  A_NEXT (stats_order) = ts;
+  A_INC (stats_order);
+
+  return ts;
+}
+
+static int _statsnamecmp (char *a, char *b)
+{
+  ckt_type_stats *t1 = *((ckt_type_stats **)a);
+  ckt_type_stats *t2 = *((ckt_type_stats **)b);
+  return strcmp (t1->p->getName(), t2->p->getName());
+}
+
+static void _stats_json_str (FILE *fp, const char *s)
+{
+  fputc ('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      fputc ('\\', fp);
+    }
+    fputc (*s, fp);
+  }
+  fputc ('"', fp);
+}
+
+/* -- pins-per-net histogram, or null if nets have not been created -- */
+static void _stats_json_fo (FILE *fp, double *fo)
+{
+  if (!fo) {
+    fprintf (fp, "null");
+    return;
+  }
+  fputc ('[', fp);
+  for (int i=0; i < STATS_FO_BUCKETS; i++) {
+    fprintf (fp, "%s%.0f", i > 0 ? ", " : "", fo[i]);
+  }
+  fputc (']', fp);
+}
+
+static int process_ckt_stats (int argc, char **argv)
+{
+  FILE *fp = NULL;
+
+  if (!std_argcheck (argc, argv, argc == 1 ? 1 : 3, "[-json <file>]",
+		     F.ckt_gen ? STATE_EXPANDED : STATE_ERROR)) {
+    return LISP_RET_ERROR;
+  }
+  if (argc == 3) {
+    if (strcmp (argv[1], "-json") != 0) {
+      fprintf (stderr, "%s: only -json <file> supported as an argument\n",
+	       argv[0]);
+      return LISP_RET_ERROR;
+    }
+    fp = std_open_output (argv[0], argv[2]);
+    if (!fp) {
+      fprintf (stderr, "%s: could not open file `%s' for writing\n",
+	       argv[0], argv[2]);
+      return LISP_RET_ERROR;
+    }
+  }
+  save_to_log (argc, argv, "ss");
+
+  ActNetlistPass *np = getNetlistPass ();
+  if (!np->completed()) {
+    np->run (F.act_toplevel);
+    F.ckt_gen = 1;
+  }
+  ActPass *pass = F.act_design->pass_find ("booleanize");
+  ActBooleanizePass *bp =
+    pass ? dynamic_cast<ActBooleanizePass *> (pass) : NULL;
+
+  if (!stats_cache) {
+    stats_cache = phash_new (32);
+    A_INIT (stats_order);
+  }
+  ckt_type_stats *top = _type_stats (np, bp, F.act_toplevel);
+
+  /* -- occurrences: walk parents before children -- */
+  for (int i=0; i < A_LEN (stats_order); i++) {
+    stats_order[i]->occ = 0;
+  }
+  top->occ = 1;
+  for (int i=A_LEN (stats_order)-1; i >= 0; i--) {
+    ckt_type_stats *ts = stats_order[i];
+    for (int j=0; j < A_LEN (ts->ch); j++) {
+      phash_bucket_t *b = phash_lookup (stats_cache, ts->ch[j].p);
+      Assert (b, "What?");
+      ((ckt_type_stats *)b->v)->occ += ts->occ*ts->ch[j].count;
+    }
+  }
+
+  A_DECL (ckt_type_stats *, used);
+  A_INIT (used);
+  for (int i=0; i < A_LEN (stats_order); i++) {
+    if (stats_order[i]->occ > 0) {
+      A_NEW (used, ckt_type_stats *);
+      A_NEXT (used) = stats_order[i];
+      A_INC (used);
+    }
+  }
+  if (A_LEN (used) > 1) {
+    mygenmergesort ((char *)used, sizeof (ckt_type_stats *), A_LEN (used),
+		    _statsnamecmp);
+  }
+
+  /* -- nets only have pins once ckt:mk-nets has been run -- */
+  int have_nets = 0;
+  for (int i=0; i < STATS_FO_BUCKETS; i++) {
+    if (top->fo[i] > 0) {
+      have_nets = 1;
+    }
+  }
+  if (!have_nets) {
+    warning ("%s: no pins-per-net histogram; run ckt:mk-nets first", argv[0]);
+  }
+
+  LispSetReturnListStart ();
+
+  LispAppendListStart ();
+  LispAppendReturnFloat (top->insts);
+  LispAppendReturnFloat (top->cells);
+  LispAppendReturnFloat (top->tfets);
+  LispAppendReturnFloat (top->tw);
+  LispAppendReturnFloat (top->tl);
+  LispAppendReturnFloat (top->area);
+  LispAppendListStart ();
+  for (int i=0; have_nets && i < STATS_FO_BUCKETS; i++) {
+    LispAppendReturnFloat (top->fo[i]);
+  }
+  LispAppendListEnd ();
+  LispAppendListEnd ();
+
+  for (int i=0; i < A_LEN (used); i++) {
+    LispAppendListStart ();
+    LispAppendReturnString (used[i]->p->getName());
+    LispAppendReturnFloat (used[i]->occ);
+    LispAppendReturnInt (used[i]->fets);
+    LispAppendReturnFloat (used[i]->tfets);
+    LispAppendReturnFloat (used[i]->tw);
+    LispAppendReturnFloat (used[i]->tl);
+    LispAppendReturnFloat (used[i]->area);
+    LispAppendListStart ();
+    for (int j=0; have_nets && j < STATS_FO_BUCKETS; j++) {
+      LispAppendReturnFloat (used[i]->fo[j]);
+    }
+    LispAppendListEnd ();
+    LispAppendListEnd ();
+  }
+
+  LispSetReturnListEnd ();
+
+  if (fp) {
+    fprintf (fp, "{\n  \"design\": {\"instances\": %.0f, \"cells\": %.0f, "
+	     "\"transistors\": %.0f, \"W\": %g, \"L\": %g, \"area\": %g,"
+	     " \"pins_per_net\": ", top->insts, top->cells, top->tfets,
+	     top->tw, top->tl, top->area);
+    _stats_json_fo (fp, have_nets ? top->fo : NULL);
+    fprintf (fp, "},\n  \"types\": [");
+    for (int i=0; i < A_LEN (used); i++) {
+      fprintf (fp, "%s\n    {\"name\": ", i > 0 ? "," : "");
+      _stats_json_str (fp, used[i]->p->getName());
+      fprintf (fp, ", \"count\": %.0f, \"local_transistors\": %d, "
+	       "\"transistors\": %.0f, \"W\": %g, \"L\": %g, "
+	       "\"area\": %g, \"pins_per_net\": ", used[i]->occ, used[i]->fets,
+	       used[i]->tfets, used[i]->tw, used[i]->tl, used[i]->area);
+      _stats_json_fo (fp, have_nets ? used[i]->fo : NULL);
+      fprintf (fp, "}");
+    }
+    fprintf (fp, "\n  ]\n}\n");
+    std_close_output (fp);
+  }
+  A_FREE (used);
+
+  return LISP_RET_LIST;
+}
+
+
 /*************************************************************************
  *
  *  Cell generation functions
@@ -276,6 +853,77 @@ static ActCellPass *getCellPass()
   return cp;
 }
 
+/*
+ * Cells used by the design, sorted by name. Computed once after
+ * mapping and dropped whenever the netlist is refreshed after edits.
+ */
+static A_DECL (Process *, cell_used);
+static int cell_used_valid = 0;
+
+static int _cellnamecmp (char *a, char *b)
+{
+  Process *p1 = *((Process **)a);
+  Process *p2 = *((Process **)b);
+  return strcmp (p1->getName(), p2->getName());
+}
+
+static void _cell_used_clear (void)
+{
+  if (cell_used_valid) {
+    A_FREE (cell_used);
+    cell_used_valid = 0;
+  }
+}
+
+static void _stats_clear (void);
+
+/*
+ * Drop all cached design information; called when the netlist changes
+ */
+void ckt_caches_clear (void)
+{
+  _cell_used_clear ();
+  _stats_clear ();
+#ifdef FOUND_timing_actpin
+  timer_netlist_changed ();
+#endif
+}
+
+/*
+ * Netlist edits cannot be undone by timer:whatif-abort, so they are
+ * refused while a what-if sandbox is open.
+ */
+static int _whatif_check (const char *cmd)
+{
+#ifdef FOUND_timing_actpin
+  if (timer_whatif_active ()) {
+    fprintf (stderr, "%s: netlist edits not allowed in a what-if sandbox\n",
+	     cmd);
+    return 0;
+  }
+#endif
+  return 1;
+}
+
+static void _cell_used_compute (ActCellPass *cp)
+{
+  if (cell_used_valid) {
+    return;
+  }
+  A_INIT (cell_used);
+  list_t *l = cp->getUsedCells ();
+  for (listitem_t *li = list_first (l); li; li = list_next (li)) {
+    A_NEW (cell_used, Process *);
+    A_NEXT (cell_used) = (Process *) list_value (li);
+    A_INC (cell_used);
+  }
+  if (A_LEN (cell_used) > 1) {
+    mygenmergesort ((char *)cell_used, sizeof (Process *), A_LEN (cell_used),
+		    _cellnamecmp);
+  }
+  cell_used_valid = 1;
+}
+
 static int process_cell_map (int argc, char **argv)
 {
   bool list_cells = false;
@@ -295,14 +943,27 @@ static int process_cell_map (int argc, char **argv)
   ActCellPass *cp = getCellPass();
   if (!cp->completed()) {
     list_t *l;
+    ckt_caches_clear ();
     cp->run (F.act_toplevel);
     l = cp->getNewCells ();
     if (list_length (l) > 0) {
-      printf ("WARNING: new cells generated; please update your cell library.\n(Use ckt:cell-save to see the new cells.) New cell names are:\n");
+      /* -- report new cells in name order, independent of traversal -- */
+      A_DECL (Process *, nc);
+      A_INIT (nc);
       for (listitem_t *li = list_first (l); li; li = list_next (li)) {
-	printf ("   %s\n", ((Process *)list_value (li))->getName());
+	A_NEW (nc, Process *);
+	A_NEXT (nc) = (Process *) list_value (li);
+	A_INC (nc);
       }
+      mygenmergesort ((char *)nc, sizeof (Process *), A_LEN (nc),
+		      _cellnamecmp);
+      printf ("WARNING: new cells generated; please update your cell library.\n(Use ckt:cell-save to see the new cells.) New cell names are:\n");
+      for (int i=0; i < A_LEN (nc); i++) {
+	printf ("   %s\n", nc[i]->getName());
+      }
+      A_FREE (nc);
     }
+    _cell_used_compute (cp);
   }
   else {
     printf ("%s: cell pass already executed; skipped\n", argv[0]);
@@ -310,15 +971,14 @@ static int process_cell_map (int argc, char **argv)
 
   if (list_cells) {
     // display cell stats both on a fresh run and when called again
-    list_t *l;
-    l = cp->getUsedCells ();
-    if (list_length (l) > 0) {
+    _cell_used_compute (cp);
+    if (A_LEN (cell_used) > 0) {
       printf ("INFO: the following cells are used in the design:\n");
-      for (listitem_t *li = list_first (l); li; li = list_next (li)) {
-	printf ("   %s\n", ((Process *)list_value (li))->getName());
+      for (int i=0; i < A_LEN (cell_used); i++) {
+	printf ("   %s\n", cell_used[i]->getName());
       }
     }
-    printf ("   Number of unique cells: %d ", list_length (l));
+    printf ("   Number of unique cells: %d ", A_LEN (cell_used));
   }
 
   F.cell_map = 1;
@@ -351,6 +1011,226 @@ static int process_cell_save (int argc, char **argv)
 }
 
 
+/*------------------------------------------------------------------------
+ *
+ *  Buffer insertion batches
+ *
+ *  While a batch is open, cell-addbuf and cell-addbufs validate
+ *  their arguments and queue the request instead of editing the
+ *  design. The commit applies all queued buffers and refreshes the
+ *  passes once. A batch is not a transaction: Process::addBuffer
+ *  cannot be undone, so if an insertion fails at commit, the buffers
+ *  already added stay in the design and the failures are reported.
+ *
+ *------------------------------------------------------------------------
+ */
+struct buf_batch_entry {
+  Process *proc;		/* process where the buffer is added */
+  Process *buftype;		/* buffer cell */
+  list_t *pins;			/* <inst> <pin> ActId pairs */
+  unsigned int single:1;	/* 1 if from cell-addbuf */
+};
+
+static struct {
+  int active;			/* 1 if a batch is open */
+  struct Hashtable *H;		/* proc/inst/pin already queued */
+  A_DECL (buf_batch_entry, e);	/* queued buffers */
+} buf_batch;
+
+static void _free_pin_list (list_t *l)
+{
+  for (listitem_t *li = list_first (l); li; li = list_next (li)) {
+    ActId *t = (ActId *) list_value (li);
+    delete t;
+  }
+  list_free (l);
+}
+
+static void _buf_batch_clear (void)
+{
+  for (int i=0; i < A_LEN (buf_batch.e); i++) {
+    _free_pin_list (buf_batch.e[i].pins);
+  }
+  A_FREE (buf_batch.e);
+  A_INIT (buf_batch.e);
+  if (buf_batch.H) {
+    hash_free (buf_batch.H);
+    buf_batch.H = NULL;
+  }
+  buf_batch.active = 0;
+}
+
+/*
+ * Parse <inst> <pin> and append the pair to the list. Returns 0 on
+ * error.
+ */
+static int _parse_inst_pin (const char *cmd, const char *inst,
+			    const char *pin, list_t *l)
+{
+  ActId *name = my_parse_id (inst);
+  if (!name) {
+    fprintf (stderr, "%s: could not parse identifier `%s'\n", cmd, inst);
+    return 0;
+  }
+
+  if (name->Rest()) {
+    delete name;
+    fprintf (stderr, "%s: `%s' needs to be a simple instance name\n",
+	     cmd, inst);
+    return 0;
+  }
+
+  ActId *tmp = my_parse_id (pin);
+  if (!tmp) {
+    fprintf (stderr, "%s: could not parse identifier `%s'\n", cmd, pin);
+    delete name;
+    return 0;
+  }
+
+  if (tmp->Rest()) {
+    delete tmp;
+    delete name;
+    fprintf (stderr, "%s: `%s' needs to be a simple pin name\n", cmd, pin);
+    return 0;
+  }
+  list_append (l, name);
+  list_append (l, tmp);
+  return 1;
+}
+
+/*
+ * Find and expand the buffer cell
+ */
+static Process *_find_buffer_type (const char *cmd, const char *bname)
+{
+  Process *buftype = F.act_design->findProcess (bname, true);
+  if (!buftype) {
+    fprintf (stderr, "%s: could not find buffer type `%s'\n", cmd, bname);
+    return NULL;
+  }
+
+  if (!buftype->isExpanded()) {
+    buftype = buftype->Expand (ActNamespace::Global(),
+			       buftype->CurScope(), 0, NULL);
+  }
+  Assert (buftype->isExpanded(), "What?");
+  return buftype;
+}
+
+/*
+ * Find the process and buffer type for a buffer insertion command.
+ */
+static int _find_buffer_procs (const char *cmd, const char *pname,
+			       const char *bname,
+			       Process **proc, Process **buftype)
+{
+  *proc = F.act_design->findProcess (pname);
+  if (!*proc) {
+    fprintf (stderr, "%s: could not find process `%s'\n", cmd, pname);
+    return 0;
+  }
+
+  if (!(*proc)->isExpanded()) {
+    fprintf (stderr, "%s: Process `%s' is not expanded\n", cmd, pname);
+    return 0;
+  }
+
+  *buftype = _find_buffer_type (cmd, bname);
+  if (!*buftype) {
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Name of an <inst> <pin> pair in <proc>, used to find pins that are
+ * buffered twice.
+ */
+static void _buf_pin_key (char *buf, int sz, Process *proc,
+			  ActId *inst, ActId *pin)
+{
+  snprintf (buf, sz, "%s/", proc->getName());
+  inst->sPrint (buf + strlen (buf), sz - strlen (buf));
+  snprintf (buf + strlen (buf), sz - strlen (buf), "/%s", pin->getName());
+}
+
+/*
+ * Check that the <inst> <pin> pairs exist in the process, and that no
+ * pin appears twice in the list. If <H> is not NULL, the pins must not
+ * have been queued in the open batch either, and they are recorded in
+ * <H> once the whole list has been checked.
+ */
+static int _buf_batch_validate (const char *cmd, Process *proc, list_t *l,
+				struct Hashtable *H)
+{
+  char buf[10240];
+  struct Hashtable *seen = hash_new (8);
+  int ok = 1;
+  
+  for (listitem_t *li = list_first (l); ok && li; li = list_next (li)) {
+    ActId *inst = (ActId *) list_value (li);
+    li = list_next (li);
+    ActId *pin = (ActId *) list_value (li);
+
+    InstType *it = proc->CurScope()->Lookup (inst->getName());
+    if (!it || !TypeFactory::isProcessType (it)) {
+      fprintf (stderr, "%s: `%s' is not an instance in `%s'\n", cmd,
+	       inst->getName(), proc->getName());
+      ok = 0;
+      break;
+    }
+    Process *ip = dynamic_cast<Process *> (it->BaseType());
+    Assert (ip, "What?");
+    if (ip->FindPort (pin->getName()) <= 0) {
+      fprintf (stderr, "%s: `%s' is not a pin of `%s'\n", cmd,
+	       pin->getName(), ip->getName());
+      ok = 0;
+      break;
+    }
+
+    _buf_pin_key (buf, 10240, proc, inst, pin);
+    if (hash_lookup (seen, buf)) {
+      fprintf (stderr, "%s: pin `%s' listed more than once\n", cmd, buf);
+      ok = 0;
+    }
+    else if (H && hash_lookup (H, buf)) {
+      fprintf (stderr, "%s: pin `%s' already buffered in this batch\n",
+	       cmd, buf);
+      ok = 0;
+    }
+    else {
+      hash_add (seen, buf);
+    }
+  }
+
+  /* -- all ok, so now record the pins -- */
+  if (ok && H) {
+    hash_bucket_t *b;
+    hash_iter_t iter;
+    hash_iter_init (seen, &iter);
+    while ((b = hash_iter_next (seen, &iter))) {
+      hash_add (H, b->key);
+    }
+  }
+  hash_free (seen);
+  return ok;
+}
+
+/*
+ * Queue a buffer insertion; the batch takes ownership of the
+ * pin list.
+ */
+static void _buf_batch_add (Process *proc, Process *buftype, list_t *l,
+			  int single)
+{
+  A_NEW (buf_batch.e, buf_batch_entry);
+  A_NEXT (buf_batch.e).proc = proc;
+  A_NEXT (buf_batch.e).buftype = buftype;
+  A_NEXT (buf_batch.e).pins = l;
+  A_NEXT (buf_batch.e).single = single;
+  A_INC (buf_batch.e);
+}
+
 static int process_add_buffer (int argc, char **argv)
 {
   FILE *fp;
@@ -367,75 +1247,51 @@ static int process_add_buffer (int argc, char **argv)
     return LISP_RET_ERROR;
   }
   F.s = tmp_s;
+  if (!_whatif_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
 
   ActCellPass *cp = getCellPass();
   Assert (cp && cp->completed(), "What?");
 
-  Process *proc = F.act_design->findProcess (argv[1]);
-  if (!proc) {
-    fprintf (stderr, "%s: could not find process `%s'\n", argv[0], argv[1]);
-    return LISP_RET_ERROR;
-  }
+  Process *proc, *buftype;
 
-  if (!proc->isExpanded()) {
-    fprintf (stderr, "%s: Process `%s' is not expanded\n", argv[0], argv[1]);
-    return LISP_RET_ERROR;
-  }
-
-  ActId *name = my_parse_id (argv[2]);
-  if (!name) {
-    fprintf (stderr, "%s: could not parse identifier `%s'\n", argv[0], argv[2]);
+  if (!_find_buffer_procs (argv[0], argv[1], argv[4], &proc, &buftype)) {
     return LISP_RET_ERROR;
   }
 
-  if (name->Rest()) {
-    delete name;
-    fprintf (stderr, "%s: `%s' needs to be a simple instance name\n",
-	     argv[0], argv[2]);
-    return LISP_RET_ERROR;
-  }
+  list_t *l = list_new ();
 
-  ActId *tmp = my_parse_id (argv[3]);
-  if (!tmp) {
-    fprintf (stderr, "%s: could not parse identifier `%s'\n", argv[0], argv[3]);
-    delete name;
+  if (!_parse_inst_pin (argv[0], argv[2], argv[3], l)) {
+    _free_pin_list (l);
     return LISP_RET_ERROR;
   }
 
-  if (tmp->Rest()) {
-    delete tmp;
-    delete name;
-    fprintf (stderr, "%s: `%s' needs to be a simple pin name\n",
-	     argv[0], argv[3]);
+  if (!_buf_batch_validate (argv[0], proc, l,
+			   buf_batch.active ? buf_batch.H : NULL)) {
+    _free_pin_list (l);
     return LISP_RET_ERROR;
   }
 
-  Process *buftype = F.act_design->findProcess (argv[4], true);
-  if (!buftype) {
-    fprintf (stderr, "%s: could not find buffer type `%s'\n", argv[0], argv[4]);
-    delete tmp;
-    delete name;
-    return LISP_RET_ERROR;
+  if (buf_batch.active) {
+    _buf_batch_add (proc, buftype, l, 1);
+    save_to_log (argc, argv, "s*");
+    return LISP_RET_TRUE;
   }
 
-  if (!buftype->isExpanded()) {
-    buftype = buftype->Expand (ActNamespace::Global(),
-			       buftype->CurScope(), 0, NULL);
-  }
-  Assert (buftype->isExpanded(), "What?");
+  ActId *name = (ActId *) list_value (list_first (l));
+  ActId *tmp = (ActId *) list_value (list_next (list_first (l)));
 
   const char *nm;
   if ((nm = proc->addBuffer (name, tmp, buftype, true))) {
     save_to_log (argc, argv, "s*");
     LispSetReturnString (nm);
     F.s = STATE_DIRTY;
-    delete tmp;
-    delete name;
+    _free_pin_list (l);
     return LISP_RET_STRING;
   }
   else {
-    delete tmp;
-    delete name;
+    _free_pin_list (l);
     return LISP_RET_ERROR;
   }
 }
@@ -463,92 +1319,184 @@ static int process_add_buffers (int argc, char **argv)
   }
 
   F.s = tmp_s;
+  if (!_whatif_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
 
   ActCellPass *cp = getCellPass();
   Assert (cp && cp->completed(), "What?");
 
-  Process *proc = F.act_design->findProcess (argv[1]);
-  if (!proc) {
-    fprintf (stderr, "%s: could not find process `%s'\n", argv[0], argv[1]);
+  Process *proc, *buftype;
+
+  if (!_find_buffer_procs (argv[0], argv[1], argv[2], &proc, &buftype)) {
     return LISP_RET_ERROR;
   }
 
-  if (!proc->isExpanded()) {
-    fprintf (stderr, "%s: Process `%s' is not expanded\n", argv[0], argv[1]);
+  list_t *l = list_new ();
+
+  for (int i = 3; i < argc; i+= 2) {
+    if (!_parse_inst_pin (argv[0], argv[i], argv[i+1], l)) {
+      _free_pin_list (l);
+      return LISP_RET_ERROR;
+    }
+  }
+
+  if (!_buf_batch_validate (argv[0], proc, l,
+			   buf_batch.active ? buf_batch.H : NULL)) {
+    _free_pin_list (l);
     return LISP_RET_ERROR;
   }
 
-  Process *buftype = F.act_design->findProcess (argv[2], true);
-  if (!buftype) {
-    fprintf (stderr, "%s: could not find buffer type `%s'\n", argv[0], argv[2]);
+  if (buf_batch.active) {
+    _buf_batch_add (proc, buftype, l, 0);
+    save_to_log (argc, argv, "s*");
+    return LISP_RET_TRUE;
+  }
+
+  const char *nm;
+  if ((nm = proc->addBuffer (buftype, l))) {
+    save_to_log (argc, argv, "s*");
+    LispSetReturnString (nm);
+    F.s = STATE_DIRTY;
+    _free_pin_list (l);
+    return LISP_RET_STRING;
+  }
+  else {
+    fprintf (stderr, "%s: could not add buffer `%s' in `%s'\n", argv[0],
+	     argv[2], argv[1]);
+    _free_pin_list (l);
     return LISP_RET_ERROR;
   }
+}
 
-  if (!buftype->isExpanded()) {
-    buftype = buftype->Expand (ActNamespace::Global(),
-			       buftype->CurScope(), 0, NULL);
+/*
+ * Discard an open batch; the queued entries refer to processes that
+ * are about to be replaced by re-expansion.
+ */
+void ckt_buffer_batch_abort (void)
+{
+  if (buf_batch.active) {
+    warning ("open buffer batch discarded (%d queued)", A_LEN (buf_batch.e));
+    _buf_batch_clear ();
   }
-  Assert (buftype->isExpanded(), "What?");
+}
 
-  list_t *l = list_new ();
+static int process_buf_batch_begin (int argc, char **argv)
+{
+  design_state tmp_s;
 
-#define FREE_LIST							\
-  do {									\
-    for (listitem_t *li = list_first (l); li; li = list_next (li)) {	\
-      ActId *t = (ActId *) list_value (li);				\
-      delete t;								\
-    }									\
-    list_free (l);							\
-  } while (0)
+  tmp_s = F.s;
+  if (F.s == STATE_DIRTY) {
+    F.s = STATE_EXPANDED;
+  }
+
+  if (!std_argcheck (argc, argv, 1, "",
+		     F.cell_map ? STATE_EXPANDED : STATE_ERROR)) {
+    F.s = tmp_s;
+    return LISP_RET_ERROR;
+  }
+  F.s = tmp_s;
+
+  if (buf_batch.active) {
+    fprintf (stderr, "%s: buffer batch already open\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  save_to_log (argc, argv, NULL);
+
+  A_INIT (buf_batch.e);
+  buf_batch.H = hash_new (128);
+  buf_batch.active = 1;
+  
+  return LISP_RET_TRUE;
+}
+
+static int process_buf_batch_abort (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_ANY)) {
+    return LISP_RET_ERROR;
+  }
+  if (!buf_batch.active) {
+    fprintf (stderr, "%s: no open buffer batch\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  save_to_log (argc, argv, NULL);
+  _buf_batch_clear ();
+  return LISP_RET_TRUE;
+}
 
-  for (int i = 3; i < argc; i+= 2) {
-    ActId *name = my_parse_id (argv[i]);
-    if (!name) {
-      fprintf (stderr, "%s: could not parse identifier `%s'\n", argv[0], argv[i]);
-      FREE_LIST;
-      return LISP_RET_ERROR;
+/*
+ * Apply all queued buffers. Failed insertions are reported and
+ * skipped; the ones already applied are kept. Returns the number of
+ * failed insertions; the names of the new buffers are appended to the
+ * current return list if ret_names is set.
+ */
+static int _buf_batch_apply (const char *cmd, int ret_names)
+{
+  int nerr = 0;
+  int napplied = 0;
+
+  for (int i=0; i < A_LEN (buf_batch.e); i++) {
+    buf_batch_entry *b = &buf_batch.e[i];
+    const char *nm;
+    
+    if (b->single) {
+      ActId *name = (ActId *) list_value (list_first (b->pins));
+      ActId *pin = (ActId *) list_value (list_next (list_first (b->pins)));
+      nm = b->proc->addBuffer (name, pin, b->buftype, true);
     }
-
-    if (name->Rest()) {
-      delete name;
-      fprintf (stderr, "%s: `%s' needs to be a simple instance name\n",
-	       argv[0], argv[2]);
-      FREE_LIST;
-      return LISP_RET_ERROR;
+    else {
+      nm = b->proc->addBuffer (b->buftype, b->pins);
     }
-
-    list_append (l, name);
-
-    ActId *tmp = my_parse_id (argv[i+1]);
-    if (!tmp) {
-      fprintf (stderr, "%s: could not parse identifier `%s'\n", argv[0], argv[i+1]);
-      FREE_LIST;
-      return LISP_RET_ERROR;
+    if (nm) {
+      napplied++;
+      if (ret_names) {
+	LispAppendReturnString (nm);
+      }
     }
-
-    if (tmp->Rest()) {
-      delete tmp;
-      FREE_LIST;
-      fprintf (stderr, "%s: `%s' needs to be a simple pin name\n",
-	       argv[0], argv[i+1]);
-      return LISP_RET_ERROR;
+    else {
+      char buf[10240];
+      ActId *inst = (ActId *) list_value (list_first (b->pins));
+      ActId *pin = (ActId *) list_value (list_next (list_first (b->pins)));
+      _buf_pin_key (buf, 10240, b->proc, inst, pin);
+      fprintf (stderr, "%s: could not add buffer at `%s'\n", cmd, buf);
+      nerr++;
     }
-    list_append (l, tmp);
   }
 
-  const char *nm;
-  if ((nm = proc->addBuffer (buftype, l))) {
-    save_to_log (argc, argv, "s*");
-    LispSetReturnString (nm);
-    F.s = STATE_DIRTY;
-    FREE_LIST;
-    return LISP_RET_STRING;
+  if (napplied > 0 || F.s == STATE_DIRTY) {
+    ActPass::refreshAll (F.act_design, F.act_toplevel);
+    ckt_caches_clear ();
   }
-  else {
-    printf ("failed!\n");
-    FREE_LIST;
+  F.s = STATE_EXPANDED;
+
+  _buf_batch_clear ();
+  
+  return nerr;
+}
+
+static int process_buf_batch_commit (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_ANY)) {
+    return LISP_RET_ERROR;
+  }
+  if (!buf_batch.active) {
+    fprintf (stderr, "%s: no open buffer batch\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!_whatif_check (argv[0])) {
     return LISP_RET_ERROR;
   }
+  save_to_log (argc, argv, NULL);
+
+  LispSetReturnListStart ();
+  int nerr = _buf_batch_apply (argv[0], 1);
+  LispSetReturnListEnd ();
+
+  if (nerr > 0) {
+    warning ("%s: %d buffer insertion%s failed", argv[0], nerr,
+	     nerr > 1 ? "s" : "");
+  }
+  return LISP_RET_LIST;
 }
 
 static int process_edit_cell (int argc, char **argv)
@@ -567,6 +1515,9 @@ static int process_edit_cell (int argc, char **argv)
     return LISP_RET_ERROR;
   }
   F.s = tmp_s;
+  if (!_whatif_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
 
   ActCellPass *cp = getCellPass();
   Assert (cp && cp->completed(), "What?");
@@ -634,8 +1585,18 @@ static int process_update_cell (int argc, char **argv)
   }
   F.s = tmp_s;
 
+  if (buf_batch.active) {
+    fprintf (stderr, "%s: commit or abort the open buffer batch first\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!_whatif_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
+
   if (tmp_s == STATE_DIRTY) {
     ActPass::refreshAll (F.act_design, F.act_toplevel);
+    ckt_caches_clear ();
   }
   save_to_log (argc, argv, "s");
   F.s = STATE_EXPANDED;
@@ -727,26 +1688,13 @@ static int found_pin (list_t *l, ActId *pin)
 }
   
 
-static int process_net_to_pins (int argc, char **argv)
+/*
+ * Return the list of cell pins connected to the net <tmp>, as full
+ * instance paths ending in the pin name. Takes ownership of <tmp>;
+ * the caller must free the list and the ActIds in it.
+ */
+static list_t *_net_to_pins (ActId *tmp)
 {
-  if (!std_argcheck (argc, argv, 2, "<net>",
-		     F.cell_map ? STATE_EXPANDED : STATE_ERROR)) {
-    return LISP_RET_ERROR;
-  }
-
-  ActCellPass *cp = getCellPass();
-  Assert (cp && cp->completed(), "What?");
-
-  ActId *tmp = my_parse_id (argv[1]);
-  if (!tmp) {
-    fprintf (stderr, "%s: could not parse identifier `%s'\n", argv[0], argv[1]);
-    return LISP_RET_ERROR;
-  }
-
-  if (!validate_signal (argv[0], tmp)) {
-    return LISP_RET_ERROR;
-  }
-
   // 1. foo.bar.baz.q[3].p : check that this exists, and is a Boolean
   // 2. split this into <instance-prefix>.<local-signal>
   // Use nonProcSuffix!
@@ -1015,6 +1963,31 @@ static int process_net_to_pins (int argc, char **argv)
   }
   list_free (visited);
 
+  return ret_pins;
+}
+
+static int process_net_to_pins (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 2, "<net>",
+		     F.cell_map ? STATE_EXPANDED : STATE_ERROR)) {
+    return LISP_RET_ERROR;
+  }
+
+  ActCellPass *cp = getCellPass();
+  Assert (cp && cp->completed(), "What?");
+
+  ActId *tmp = my_parse_id (argv[1]);
+  if (!tmp) {
+    fprintf (stderr, "%s: could not parse identifier `%s'\n", argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+
+  if (!validate_signal (argv[0], tmp)) {
+    return LISP_RET_ERROR;
+  }
+
+  list_t *ret_pins = _net_to_pins (tmp);
+
   LispSetReturnListStart ();
 
 
@@ -1167,6 +2140,506 @@ static int process_cell_to_pins (int argc, char **argv)
 }
 
 
+#ifdef FOUND_timing_actpin
+
+/*
+ * Split a full pin name <path>.<inst>.<pin> into the process type
+ * that contains <inst>, and fresh copies of <inst> and <pin>.
+ */
+static Process *_split_pin (ActId *x, ActId **inst, ActId **pin)
+{
+  ActId *ip, *prev, *r;
+  Process *proc;
+
+  prev = NULL;
+  ip = x;
+  while (ip->Rest() && ip->Rest()->Rest()) {
+    prev = ip;
+    ip = ip->Rest();
+  }
+  if (!ip->Rest()) {
+    return NULL;
+  }
+  if (prev) {
+    prev->prune ();
+    InstType *it = F.act_toplevel->CurScope()->FullLookup (x, NULL);
+    prev->Append (ip);
+    if (!it || !TypeFactory::isProcessType (it)) {
+      return NULL;
+    }
+    proc = dynamic_cast<Process *> (it->BaseType());
+  }
+  else {
+    proc = F.act_toplevel;
+  }
+  r = ip->Rest();
+  ip->prune ();
+  *inst = ip->Clone ();
+  ip->Append (r);
+  *pin = r->Clone ();
+  return proc;
+}
+
+/*
+ * Process types below <p> in topological order: every type comes
+ * before the types it instantiates. <H> records the types visited.
+ */
+static void _proc_topo (Process *p, struct pHashtable *H, list_t *order)
+{
+  phash_bucket_t *b;
+
+  if (phash_lookup (H, p)) {
+    return;
+  }
+  b = phash_add (H, p);
+  b->i = 0;
+  ActInstiter it(p->CurScope());
+  for (it = it.begin(); it != it.end(); it++) {
+    ValueIdx *vx = (*it);
+    if (!TypeFactory::isProcessType (vx->t)) continue;
+    Process *cp = dynamic_cast<Process *> (vx->t->BaseType());
+    if (!cp) continue;
+    _proc_topo (cp, H, order);
+  }
+  list_append_head (order, p);
+}
+
+/*
+ * Number of instances of each process type in the design, in one pass
+ * over the types from the top down. Returns a table from Process * to
+ * the count (in the i field); free it with phash_free().
+ */
+static struct pHashtable *_proc_counts (void)
+{
+  struct pHashtable *H = phash_new (32);
+  list_t *order = list_new ();
+
+  _proc_topo (F.act_toplevel, H, order);
+  phash_lookup (H, F.act_toplevel)->i = 1;
+  for (listitem_t *li = list_first (order); li; li = list_next (li)) {
+    Process *p = (Process *) list_value (li);
+    int n = phash_lookup (H, p)->i;
+    ActInstiter it(p->CurScope());
+    for (it = it.begin(); it != it.end(); it++) {
+      ValueIdx *vx = (*it);
+      if (!TypeFactory::isProcessType (vx->t)) continue;
+      Process *cp = dynamic_cast<Process *> (vx->t->BaseType());
+      if (!cp) continue;
+      int count = vx->t->arrayInfo() ? vx->t->arrayInfo()->size() : 1;
+      phash_lookup (H, cp)->i += n*count;
+    }
+  }
+  list_free (order);
+  return H;
+}
+
+/*
+ * Queue buffers for the driven pins of one net. The pins are grouped
+ * by the process that contains them, and each group is split evenly
+ * across ceil(ratio) buffers: one level of buffering per call.
+ *
+ * A buffer is added to the definition of the process, so it would
+ * appear in every instance of that process. Groups in a process that
+ * occurs more than once in the design (per <counts>) are skipped and
+ * counted in *nshared. Frees the pin list, and returns the number of
+ * buffers queued.
+ */
+static int _auto_buffer_net (const char *cmd, Process *buftype,
+			     list_t *pins, double ratio,
+			     struct pHashtable *counts, int *nshared)
+{
+  list_t *groups = list_new (); /* pairs: Process *, list of inst/pin */
+  listitem_t *li, *gi;
+  int count = 0;
+
+  for (li = list_first (pins); li; li = list_next (li)) {
+    ActId *x = (ActId *) list_value (li);
+    InstType *itx = F.act_toplevel->CurScope()->FullLookup (x, NULL);
+    if (itx && itx->getDir() == Type::IN) {
+      ActId *inst, *pin;
+      Process *proc = _split_pin (x, &inst, &pin);
+      if (proc) {
+	list_t *l = NULL;
+	for (gi = list_first (groups); gi; gi = list_next (list_next (gi))) {
+	  if ((Process *) list_value (gi) == proc) {
+	    l = (list_t *) list_value (list_next (gi));
+	    break;
+	  }
+	}
+	if (!l) {
+	  l = list_new ();
+	  list_append (groups, proc);
+	  list_append (groups, l);
+	}
+	/* -- instances of the same type give the same local pin -- */
+	listitem_t *ti;
+	for (ti = list_first (l); ti; ti = list_next (list_next (ti))) {
+	  if (inst->isEqual ((ActId *) list_value (ti)) &&
+	      pin->isEqual ((ActId *) list_value (list_next (ti)))) {
+	    break;
+	  }
+	}
+	if (ti) {
+	  delete inst;
+	  delete pin;
+	}
+	else {
+	  list_append (l, inst);
+	  list_append (l, pin);
+	}
+      }
+    }
+    delete x;
+  }
+  list_free (pins);
+
+  for (gi = list_first (groups); gi; gi = list_next (list_next (gi))) {
+    Process *proc = (Process *) list_value (gi);
+    list_t *l = (list_t *) list_value (list_next (gi));
+    phash_bucket_t *b = phash_lookup (counts, proc);
+    if (!b || b->i != 1) {
+      (*nshared)++;
+      for (li = list_first (l); li; li = list_next (li)) {
+	delete (ActId *) list_value (li);
+      }
+      list_free (l);
+      continue;
+    }
+    int n = list_length (l)/2;
+    int nbuf = (int) ceil (ratio);
+    if (nbuf > n) {
+      nbuf = n;
+    }
+    if (nbuf < 1) {
+      nbuf = 1;
+    }
+    int per = (n + nbuf - 1)/nbuf;
+
+    list_t *chunk = NULL;
+    for (li = list_first (l); li; li = list_next (list_next (li))) {
+      if (!chunk) {
+	chunk = list_new ();
+      }
+      list_append (chunk, list_value (li));
+      list_append (chunk, list_value (list_next (li)));
+      if (list_length (chunk) == 2*per || !list_next (list_next (li))) {
+	if (_buf_batch_validate (cmd, proc, chunk, buf_batch.H)) {
+	  _buf_batch_add (proc, buftype, chunk, 0);
+	  count++;
+	}
+	else {
+	  _free_pin_list (chunk);
+	}
+	chunk = NULL;
+      }
+    }
+    list_free (l);
+  }
+  list_free (groups);
+  return count;
+}
+
+static int process_auto_buffer (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 3, "<buf> <slew-target>",
+		     F.cell_map ? STATE_EXPANDED : STATE_ERROR)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (buf_batch.active) {
+    fprintf (stderr, "%s: commit or abort the open buffer batch first\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!_whatif_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
+
+  double target = atof (argv[2]);
+  if (target <= 0) {
+    fprintf (stderr, "%s: slew target must be positive\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  Process *buftype = _find_buffer_type (argv[0], argv[1]);
+  if (!buftype) {
+    return LISP_RET_ERROR;
+  }
+  save_to_log (argc, argv, "sf");
+
+  list_t *viol = timer_slew_violations (target);
+  listitem_t *li;
+  int nnets = 0;
+  int nshared = 0;
+  struct pHashtable *counts = _proc_counts ();
+
+  A_INIT (buf_batch.e);
+  buf_batch.H = hash_new (128);
+  buf_batch.active = 1;
+
+  for (li = list_first (viol); li; li = list_next (li)) {
+    timer_slew_info *si = (timer_slew_info *) list_value (li);
+    ActId *id = my_parse_id (si->net);
+    if (id && validate_signal (argv[0], id)) {
+      if (_auto_buffer_net (argv[0], buftype, _net_to_pins (id),
+			    si->slew/target, counts, &nshared) > 0) {
+	nnets++;
+      }
+    }
+    else if (id) {
+      delete id;
+    }
+    FREE (si->net);
+    FREE (si);
+  }
+  list_free (viol);
+  phash_free (counts);
+
+  if (nshared > 0) {
+    warning ("%s: %d pin group%s not buffered; %s in a process used more than once",
+	     argv[0], nshared, nshared > 1 ? "s" : "",
+	     nshared > 1 ? "they are" : "it is");
+  }
+
+  int nbufs = A_LEN (buf_batch.e);
+  if (nbufs > 0) {
+    nbufs -= _buf_batch_apply (argv[0], 0);
+    if (!timer_retime ()) {
+      warning ("%s: re-running the timer failed", argv[0]);
+    }
+  }
+  else {
+    _buf_batch_clear ();
+  }
+
+  LispSetReturnListStart ();
+  LispAppendReturnInt (nnets);
+  LispAppendReturnInt (nbufs);
+  LispSetReturnListEnd ();
+  
+  return LISP_RET_LIST;
+}
+
+/*
+ * Upsize the cell driving <pinname> to the next member of <family>.
+ * Returns the area change, or -1 with *ok = 0 if the driver cannot be
+ * resized. <H> records instances already resized in this round.
+ *
+ * The cell is changed in the definition of the process that contains
+ * the driver, which would change every instance of that process; the
+ * driver is only resized if that process occurs once in the design
+ * according to <counts> (*shared is set otherwise).
+ */
+static double _resize_driver (const char *pinname,
+			      Process **family, int nfamily, int lef,
+			      double area_left, struct Hashtable *H,
+			      struct pHashtable *counts,
+			      int *ok, int *shared)
+{
+  ActId *x, *inst, *pin;
+  Process *proc;
+  char buf[10240];
+  int i;
+
+  *ok = 0;
+  x = my_parse_id (pinname);
+  if (!x) {
+    return -1;
+  }
+  proc = _split_pin (x, &inst, &pin);
+  delete x;
+  if (!proc) {
+    return -1;
+  }
+  delete pin;
+
+  phash_bucket_t *b = phash_lookup (counts, proc);
+  if (!b || b->i != 1) {
+    *shared = 1;
+    delete inst;
+    return -1;
+  }
+
+  if (inst->arrayInfo()) {
+    /* -- updateInst only handles simple instance names -- */
+    delete inst;
+    return -1;
+  }
+  inst->sPrint (buf, 10240);
+  InstType *it = proc->CurScope()->Lookup (inst);
+  delete inst;
+  if (!it || !TypeFactory::isProcessType (it)) {
+    return -1;
+  }
+
+  Process *cur = dynamic_cast<Process *> (it->BaseType());
+  for (i=0; i < nfamily; i++) {
+    if (family[i] == cur) break;
+  }
+  if (i >= nfamily - 1) {
+    return -1;
+  }
+
+  char key[10240];
+  snprintf (key, 10240, "%s/%s", proc->getName(), buf);
+  if (hash_lookup (H, key)) {
+    return -1;
+  }
+  double delta = _cell_area (family[i+1], lef) - _cell_area (cur, lef);
+  if (area_left >= 0 && delta > area_left) {
+    return -1;
+  }
+  if (!proc->updateInst (buf, family[i+1])) {
+    return -1;
+  }
+  hash_add (H, key);
+  *ok = 1;
+  return delta;
+}
+
+#define RESIZE_OPT_ITER 100	/* default limit on resizing rounds */
+
+static int process_resize_opt (int argc, char **argv)
+{
+  double area_lim = -1;
+  int max_iter = RESIZE_OPT_ITER;
+  int argbase = 1;
+
+  while (argbase + 1 < argc) {
+    if (strcmp (argv[argbase], "-area") == 0) {
+      area_lim = atof (argv[argbase+1]);
+    }
+    else if (strcmp (argv[argbase], "-iter") == 0) {
+      max_iter = atoi (argv[argbase+1]);
+    }
+    else {
+      break;
+    }
+    argbase += 2;
+  }
+  if (argc < argbase + 3) {
+    fprintf (stderr, "Usage: %s [-area <limit>] [-iter <n>] <slack-target> <cell1> <cell2> ...\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  /* -- argument count checked above; this checks the flow state -- */
+  if (!std_argcheck (argc, argv, argc, "",
+		     F.cell_map ? STATE_EXPANDED : STATE_ERROR)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (buf_batch.active) {
+    fprintf (stderr, "%s: commit or abort the open buffer batch first\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!_whatif_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
+
+  double target = atof (argv[argbase]);
+
+  /* -- cell family, weakest first -- */
+  A_DECL (Process *, family);
+  A_INIT (family);
+  for (int i=argbase+1; i < argc; i++) {
+    Process *c = F.act_design->findProcess (argv[i], true);
+    if (!c) {
+      fprintf (stderr, "%s: could not find cell type `%s'\n", argv[0], argv[i]);
+      A_FREE (family);
+      return LISP_RET_ERROR;
+    }
+    if (!c->isExpanded()) {
+      c = c->Expand (ActNamespace::Global(), c->CurScope(), 0, NULL);
+    }
+    Assert (c->isExpanded(), "What?");
+    A_NEW (family, Process *);
+    A_NEXT (family) = c;
+    A_INC (family);
+  }
+  save_to_log (argc, argv, "s*");
+
+  /* -- one area unit for the whole family -- */
+  int lef = 1;
+  for (int i=0; i < A_LEN (family); i++) {
+    double a;
+    if (!_lef_area (family[i], &a)) {
+      lef = 0;
+    }
+  }
+
+  double wns0 = timer_worst_fork_slack ();
+  double wns = wns0;
+  double area_delta = 0.0;
+  int nresized = 0;
+  int nshared = 0;
+  int iter;
+
+  /* -- resizing swaps leaf cells only, so the counts stay valid -- */
+  struct pHashtable *counts = _proc_counts ();
+
+  /* -- each round upsizes every violating driver by one step -- */
+  for (iter = 0; iter < max_iter && wns < target; iter++) {
+    list_t *drv = timer_fork_drivers (target);
+    struct Hashtable *H = hash_new (16);
+    listitem_t *li;
+    int moves = 0;
+
+    for (li = list_first (drv); li; li = list_next (li)) {
+      char *nm = (char *) list_value (li);
+      int ok, shared = 0;
+      double d = _resize_driver (nm, family, A_LEN (family), lef,
+				 area_lim < 0 ? -1 : area_lim - area_delta,
+				 H, counts, &ok, &shared);
+      nshared += shared;
+      if (ok) {
+	area_delta += d;
+	moves++;
+      }
+      FREE (nm);
+    }
+    list_free (drv);
+    hash_free (H);
+
+    if (moves == 0) {
+      break;
+    }
+    nresized += moves;
+    ActPass::refreshAll (F.act_design, F.act_toplevel);
+    ckt_caches_clear ();
+    F.s = STATE_EXPANDED;
+    if (!timer_retime ()) {
+      fprintf (stderr, "%s: re-running the timer failed\n", argv[0]);
+      phash_free (counts);
+      A_FREE (family);
+      return LISP_RET_ERROR;
+    }
+    wns = timer_worst_fork_slack ();
+  }
+  phash_free (counts);
+  A_FREE (family);
+
+  if (nshared > 0) {
+    warning ("%s: %d driver(s) not resized: they are inside a process that is instantiated more than once", argv[0], nshared);
+  }
+
+  LispSetReturnListStart ();
+  LispAppendReturnFloat (wns0);
+  LispAppendReturnFloat (wns);
+  LispAppendReturnFloat (area_delta);
+  LispAppendReturnInt (nresized);
+  LispSetReturnListEnd ();
+
+  return LISP_RET_LIST;
+}
+
+#endif
+
 static struct LispCliCommand ckt_cmds[] = {
   { NULL, "ACT circuit generation", NULL },
   { "map", "- generate transistor-level description",
@@ -1184,7 +2657,7 @@ static struct LispCliCommand ckt_cmds[] = {
     process_ckt_save_lvp },
   { "save-sim", "<file-prefix> - save flat .sim/.al file",
     process_ckt_save_sim },
-  { "save-vnet", "[-nocell] <file> - save Verilog netlist to <file>",
+  { "save-vnet", "[-nocell] [-split] <file|dir> - save Verilog netlist to <file>; -split writes one file per module to <dir>, listed in <dir>/modules.f",
     process_ckt_save_v },
   
 
@@ -1198,6 +2671,13 @@ static struct LispCliCommand ckt_cmds[] = {
   { "cell-edit", "<proc> <inst> <newcell> - replace cell for instance within <proc>",
     process_edit_cell },
 
+  { "buffer-batch-begin", "- queue subsequent cell-addbuf/cell-addbufs commands",
+    process_buf_batch_begin },
+  { "buffer-batch-commit", "- apply queued buffers and update the design; returns list of buffer names (failed insertions are reported, applied ones are kept)",
+    process_buf_batch_commit },
+  { "buffer-batch-abort", "- discard queued buffers",
+    process_buf_batch_abort },
+
   { "cell-update", "- take the design back to the clean state",
     process_update_cell },
 
@@ -1205,7 +2685,17 @@ static struct LispCliCommand ckt_cmds[] = {
     process_net_to_pins },
 
   { "cell->pins", "<inst> - return pins for a cell",
-    process_cell_to_pins }
+    process_cell_to_pins },
+
+  { "stats", "[-json <file>] - design statistics: returns ((#insts #cells #fets W L area (pins/net histogram)) (type count local-fets fets W L area (pins/net histogram)) ...); the histograms are empty (null in JSON) until ckt:mk-nets has been run",
+    process_ckt_stats },
+
+#ifdef FOUND_timing_actpin
+  { "auto-buffer", "<buf> <slew-target> - buffer the driven pins of nets with slew above <slew-target> (timer units) and re-run the timer; returns (#nets #buffers). Adds one level of buffers per call; run it again to buffer deeper. Pins inside process types used more than once are skipped",
+    process_auto_buffer },
+  { "resize-opt", "[-area <limit>] [-iter <n>] <slack-target> <cell1> <cell2> ... - upsize drivers of timing forks with slack below the target using the cell family (weakest first), for at most <n> rounds (default 100); returns (wns-before wns-after area-delta #resized). Area is LEF area if every cell in the family has a LEF macro, transistor W*L otherwise. Drivers inside processes that are instantiated more than once are skipped, since the edit changes the process definition",
+    process_resize_opt }
+#endif
   
 };
 
@@ -21,6 +21,10 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <common/misc.h>
+#include <lispCli.h>
 #include "flow.h"
 
 int output_window_width;
@@ -192,6 +196,209 @@ void std_close_output (FILE *fp)
 }
 
 
+/*--------------------------------------------------------------------------
+
+  Large output files: written through a big stdio buffer into a
+  temporary file that is renamed into place only once the output is
+  complete, so an interrupted or failed write never leaves a truncated
+  file behind.
+
+  Where stdio supports custom streams, the writer sees a stream whose
+  write function reports progress every STREAM_PROGRESS bytes and fails
+  once LispInterruptExecution is set. This works for writers in library
+  code as well: after an interrupt, their remaining output is dropped
+  and std_close_stream discards the temporary file.
+
+--------------------------------------------------------------------------*/
+#define STREAM_BUFSZ (4 << 20)
+#define STREAM_PROGRESS (256L << 20)
+
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+#define STREAM_COOKIE 1
+#endif
+
+struct std_stream {
+  FILE *fp;			/* stream handed to the writer */
+  FILE *out;			/* the temporary file */
+  char *cmd;			/* command, for messages */
+  char *name;			/* final name */
+  char *tmpname;		/* name while writing */
+  char *buf;			/* stdio buffer */
+  long nbytes;			/* bytes written so far */
+  long report;			/* next progress report */
+  int cancelled;		/* interrupted by the user */
+  struct std_stream *next;
+};
+
+static struct std_stream *_streams = NULL;
+
+#ifdef STREAM_COOKIE
+static int _stream_put (struct std_stream *st, const char *buf, size_t sz)
+{
+  if (LispInterruptExecution) {
+    st->cancelled = 1;
+    errno = EINTR;
+    return 0;
+  }
+  if (fwrite (buf, 1, sz, st->out) != sz) {
+    return 0;
+  }
+  st->nbytes += sz;
+  if (st->nbytes >= st->report) {
+    printf ("%s: %ld MB written\n", st->cmd, st->nbytes >> 20);
+    fflush (stdout);
+    st->report += STREAM_PROGRESS;
+  }
+  return 1;
+}
+
+/* -- seeking is not supported; only ftell() works -- */
+#if defined(__GLIBC__)
+static ssize_t _stream_write (void *cookie, const char *buf, size_t sz)
+{
+  return _stream_put ((struct std_stream *)cookie, buf, sz) ? sz : 0;
+}
+
+static int _stream_seek (void *cookie, off64_t *off, int whence)
+{
+  if (whence != SEEK_CUR || *off != 0) {
+    errno = ESPIPE;
+    return -1;
+  }
+  *off = ((struct std_stream *)cookie)->nbytes;
+  return 0;
+}
+#else
+static int _stream_write (void *cookie, const char *buf, int sz)
+{
+  return _stream_put ((struct std_stream *)cookie, buf, sz) ? sz : -1;
+}
+
+static fpos_t _stream_seek (void *cookie, fpos_t off, int whence)
+{
+  if (whence != SEEK_CUR || off != 0) {
+    errno = ESPIPE;
+    return -1;
+  }
+  return ((struct std_stream *)cookie)->nbytes;
+}
+#endif
+#endif
+
+FILE *std_open_stream (const char *cmd, const char *s)
+{
+  struct std_stream *st;
+  FILE *fp;
+  char *tmp;
+
+  if (strcmp (s, "-") == 0) {
+    return stdout;
+  }
+  MALLOC (tmp, char, strlen (s) + 32);
+  snprintf (tmp, strlen (s) + 32, "%s.tmp%d", s, (int) getpid());
+  fp = fopen (tmp, "w");
+  if (!fp) {
+    FREE (tmp);
+    return NULL;
+  }
+  NEW (st, struct std_stream);
+  st->out = fp;
+  st->cmd = Strdup (cmd);
+  st->name = Strdup (s);
+  st->tmpname = tmp;
+  st->nbytes = 0;
+  st->report = STREAM_PROGRESS;
+  st->cancelled = 0;
+  MALLOC (st->buf, char, STREAM_BUFSZ);
+
+#ifdef STREAM_COOKIE
+  /* -- the writer's stream does the buffering; the file does not -- */
+  setvbuf (fp, NULL, _IONBF, 0);
+#if defined(__GLIBC__)
+  cookie_io_functions_t io = { NULL, _stream_write, _stream_seek, NULL };
+  st->fp = fopencookie (st, "w", io);
+#else
+  st->fp = funopen (st, NULL, _stream_write, _stream_seek, NULL);
+#endif
+  if (!st->fp) {
+    fclose (fp);
+    unlink (tmp);
+    FREE (st->cmd);
+    FREE (st->name);
+    FREE (st->tmpname);
+    FREE (st->buf);
+    FREE (st);
+    return NULL;
+  }
+#else
+  st->fp = fp;
+#endif
+  setvbuf (st->fp, st->buf, _IOFBF, STREAM_BUFSZ);
+  st->next = _streams;
+  _streams = st;
+  return st->fp;
+}
+
+/*
+  Close a stream opened by std_open_stream. If <commit> is set and all
+  the data was written, the output is moved into place; otherwise it is
+  discarded. Output cut short by an interrupt is always discarded.
+  Returns 1 on success.
+*/
+int std_close_stream (FILE *fp, int commit)
+{
+  struct std_stream *st, *prev;
+  int ok;
+
+  if (fp == stdout) {
+    fflush (stdout);
+    return 1;
+  }
+  prev = NULL;
+  for (st = _streams; st; st = st->next) {
+    if (st->fp == fp) break;
+    prev = st;
+  }
+  Assert (st, "std_close_stream: unknown stream");
+  if (prev) {
+    prev->next = st->next;
+  }
+  else {
+    _streams = st->next;
+  }
+
+  ok = !ferror (fp);
+  if (fclose (fp) != 0) {
+    ok = 0;
+  }
+  if (st->out != fp && fclose (st->out) != 0) {
+    ok = 0;
+  }
+  if (st->cancelled) {
+    fprintf (stderr, "%s: interrupted; `%s' not written\n", st->cmd,
+	     st->name);
+    ok = 0;
+  }
+  if (ok && commit) {
+    if (rename (st->tmpname, st->name) != 0) {
+      ok = 0;
+    }
+  }
+  else {
+    ok = 0;
+  }
+  if (!ok) {
+    unlink (st->tmpname);
+  }
+  FREE (st->cmd);
+  FREE (st->name);
+  FREE (st->tmpname);
+  FREE (st->buf);
+  FREE (st);
+  return ok;
+}
+
+
 
 void flow_init (void)
 {
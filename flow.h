@@ -121,6 +121,8 @@ int std_argcheck (int argc, char **argv, int argnum, const char *usage,
 
 FILE *std_open_output (const char *cmd, const char *s);
 void std_close_output (FILE *fp);
+FILE *std_open_stream (const char *cmd, const char *s);
+int std_close_stream (FILE *fp, int commit);
 void flow_init (void);
 
 extern int output_window_width;
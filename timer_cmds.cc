@@ -20,6 +20,7 @@
  **************************************************************************
  */
 #include <stdio.h>
+#include <sys/stat.h>
 #include <act/passes.h>
 #include <common/list.h>
 #include <common/pp.h>
@@ -28,14 +29,19 @@
 #include "ptr_manager.h"
 #include "flow.h"
 #include <act/tech.h>
+#include <common/mytime.h>
 
 #ifdef FOUND_timing_actpin
 
 #include <act/timing/galois_api.h>
 #include "galois/eda/liberty/NldmDelayCalculator.h"
+#include "galois/Galois.h"
 #include <cmath>
 #include <cfloat>
 #include <limits>
+#include <queue>
+#include <algorithm>
+#include <random>
 
 static double act_delay_units = -1.0;
 
@@ -43,6 +49,250 @@ static ActGaloisTiming *agt = NULL;
 
 static double act_clock_period = -1.0;
 
+/*
+ * Timing corners. Each corner has its own analysis engine, built from
+ * its own liberty handles on the shared timing graph. Corner 0 is
+ * created by timer:init; <agt> is always the engine of the current
+ * corner.
+ */
+struct timer_corner {
+  char *name;
+  galois::eda::model::CellLib **libs;
+  int nlibs;
+  ActGaloisTiming *t;
+  unsigned int run:1;		/* timing results are valid */
+};
+
+static A_DECL (timer_corner, corners);
+static int cur_corner = -1;
+
+/* -- incremented every time timing results change -- */
+static unsigned long timer_epoch = 0;
+
+/* -- changes since the last timing run -- */
+static int tg_netlist_dirty = 0;	/* netlist edited */
+static int tg_caps_dirty = 0;		/* net capacitances changed */
+
+/*
+ * Capacitance added with timer:set-cap, by net. <cap_idx> maps the
+ * timing vertex of the net to its entry in <caps>; nets that are not in
+ * the table have none. When the engines are re-created, the nets are
+ * looked up again and their capacitances re-applied.
+ */
+struct cap_rec {
+  char *net;			/* net name, as given to set-cap */
+  int vid;			/* its timing vertex */
+  double val;
+};
+
+static iHashtable *cap_idx = NULL;
+static A_DECL (cap_rec, caps);
+
+/* -- SPEF files read so far, in order; re-read into new engines -- */
+static list_t *spef_files = NULL;
+
+/*
+ * What-if sandbox: capacitance changes since timer:whatif-begin, with
+ * the previous value of each, undone in reverse order on abort.
+ */
+struct whatif_edit {
+  int vid;
+  int had;			/* net had a set-cap value */
+  double prev;
+};
+
+static int whatif_active = 0;
+static int whatif_netlist = 0;	/* netlist edited inside the sandbox */
+static A_DECL (whatif_edit, whatif_log);
+
+static void _cap_clear (void)
+{
+  if (cap_idx) {
+    ihash_free (cap_idx);
+    cap_idx = NULL;
+  }
+  for (int i=0; i < A_LEN (caps); i++) {
+    FREE (caps[i].net);
+  }
+  A_FREE (caps);
+}
+
+/* -- capacitance added to <vid> with set-cap -- */
+static double _cap_get (int vid)
+{
+  ihash_bucket_t *b;
+  if (!cap_idx || !(b = ihash_lookup (cap_idx, vid))) {
+    return 0.0;
+  }
+  return caps[b->i].val;
+}
+
+/*
+ * Set the capacitance of <vid> in every corner; <net> is its name, and
+ * is only needed the first time a net is set.
+ */
+static void _cap_set (int vid, double val, const char *net)
+{
+  ihash_bucket_t *b;
+
+  if (!cap_idx) {
+    cap_idx = ihash_new (16);
+  }
+  b = ihash_lookup (cap_idx, vid);
+  if (!b) {
+    Assert (net, "New net without a name?");
+    b = ihash_add (cap_idx, vid);
+    A_NEW (caps, cap_rec);
+    A_NEXT (caps).net = Strdup (net);
+    A_NEXT (caps).vid = vid;
+    b->i = A_LEN (caps);
+    A_INC (caps);
+  }
+  caps[b->i].val = val;
+
+  for (int i=0; i < A_LEN (corners); i++) {
+    corners[i].t->setCap (vid, val);
+  }
+  tg_caps_dirty = 1;
+}
+
+static int _cap_has (int vid)
+{
+  return cap_idx && ihash_lookup (cap_idx, vid);
+}
+
+/* -- forget the set-cap value of <vid>, as if it had never been set -- */
+static void _cap_unset (int vid)
+{
+  ihash_bucket_t *b;
+  int i;
+
+  if (!cap_idx || !(b = ihash_lookup (cap_idx, vid))) {
+    return;
+  }
+  i = b->i;
+  ihash_delete (cap_idx, vid);
+  FREE (caps[i].net);
+  if (i != A_LEN (caps) - 1) {
+    caps[i] = caps[A_LEN (caps) - 1];
+    ihash_lookup (cap_idx, caps[i].vid)->i = i;
+  }
+  A_LEN (caps)--;
+
+  for (int j=0; j < A_LEN (corners); j++) {
+    corners[j].t->setCap (vid, 0);
+  }
+  tg_caps_dirty = 1;
+}
+
+/* -- undo a set-cap: back to <prev>, or to no value if it had none -- */
+static void _cap_restore (int vid, int had, double prev)
+{
+  if (had) {
+    _cap_set (vid, prev, NULL);
+  }
+  else {
+    _cap_unset (vid);
+  }
+}
+
+static void _spef_clear (void)
+{
+  listitem_t *li;
+  if (!spef_files) {
+    return;
+  }
+  for (li = list_first (spef_files); li; li = list_next (li)) {
+    FREE (list_value (li));
+  }
+  list_free (spef_files);
+  spef_files = NULL;
+}
+
+static void _spef_add (const char *file)
+{
+  if (!spef_files) {
+    spef_files = list_new ();
+  }
+  list_append (spef_files, Strdup (file));
+}
+
+/*
+ * Parasitics and capacitances are bound to the timing graph; they can
+ * only be changed while the graph matches the netlist.
+ */
+static int _loads_check (const char *cmd)
+{
+  if (tg_netlist_dirty) {
+    fprintf (stderr, "%s: netlist changed; run timer:run first\n", cmd);
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Edits to the timing graph from the command line (ticks, cuts, and
+ * constraints). These are replayed when the timing graph is rebuilt
+ * after the netlist changes.
+ */
+struct tg_edit {
+  int (*f) (int, char **);	/* command that made the edit */
+  int argc;
+  char **argv;
+};
+
+int process_timer_addconstraint (int argc, char **argv);
+static int process_timer_tick (int argc, char **argv);
+static int process_timer_cut (int argc, char **argv);
+
+static list_t *tg_edits = NULL;
+static struct Hashtable *tg_edit_hash = NULL;
+static int tg_replay = 0;	/* 1 while replaying edits */
+static unsigned long tg_graph_epoch = 0; /* bumped on graph changes */
+
+/*
+ * The same tick/cut edits in terms of timing vertex ids, for saving
+ * the edited graph; valid for the current graph only.
+ */
+#define TG_VEDIT_TICK 0
+#define TG_VEDIT_CUT  1
+
+struct tg_vedit {
+  int kind;
+  int v1, v2;
+};
+
+static A_DECL (tg_vedit, tg_vedits);
+static unsigned long tg_build_hash = 0; /* structure of the fresh graph */
+static int tg_pass_ncons = 0;	/* constraints created by the pass;
+				   later ones come from add-constraint */
+
+static void _tg_vedit_add (int kind, int v1, int v2)
+{
+  A_NEW (tg_vedits, tg_vedit);
+  A_NEXT (tg_vedits).kind = kind;
+  A_NEXT (tg_vedits).v1 = v1;
+  A_NEXT (tg_vedits).v2 = v2;
+  A_INC (tg_vedits);
+}
+
+static void _corner_free_all (void)
+{
+  if (cur_corner == -1) {
+    return;
+  }
+  for (int i=0; i < A_LEN (corners); i++) {
+    if (corners[i].t) {
+      delete corners[i].t;
+    }
+    FREE (corners[i].name);
+    FREE (corners[i].libs);
+  }
+  A_FREE (corners);
+  cur_corner = -1;
+  agt = NULL;
+}
+
 static void init (int mode = 0)
 {
   static int first = 1;
@@ -53,10 +303,7 @@ static void init (int mode = 0)
   first = 0;
   
   if (mode == 1) {
-    if (agt) {
-      delete agt;
-      agt = NULL;
-    }
+    _corner_free_all ();
     first = 1;
   }
   init_galois_shmemsys (mode);
@@ -67,24 +314,234 @@ static ActId *my_parse_id (const char *name)
   return ActId::parseId (name);
 }
 
+/*
+ * Add an edit to the journal unless the same command is already there.
+ * Returns 1 if it was added.
+ */
+static int _tg_edit_record (tg_edit *e)
+{
+  char *buf;
+  int len = 1;
+  int pos = 0;
+
+  if (!tg_edits) {
+    tg_edits = list_new ();
+    tg_edit_hash = hash_new (16);
+  }
+  for (int i=0; i < e->argc; i++) {
+    len += strlen (e->argv[i]) + 1;
+  }
+  MALLOC (buf, char, len);
+  buf[0] = '\0';
+  for (int i=0; i < e->argc; i++) {
+    snprintf (buf + pos, len - pos, "%s ", e->argv[i]);
+    pos += strlen (buf + pos);
+  }
+  if (hash_lookup (tg_edit_hash, buf)) {
+    FREE (buf);
+    return 0;
+  }
+  hash_add (tg_edit_hash, buf);
+  FREE (buf);
+  list_append (tg_edits, e);
+  return 1;
+}
+
+static void _tg_edit_free (tg_edit *e)
+{
+  for (int i=0; i < e->argc; i++) {
+    FREE (e->argv[i]);
+  }
+  FREE (e->argv);
+  FREE (e);
+}
+
+/*
+ * Record a timing graph edit and log it; nothing is recorded while
+ * edits are being replayed.
+ */
+static void _tg_edit_done (int (*f)(int, char **), int argc, char **argv,
+			   const char *fmt)
+{
+  tg_edit *e;
+
+  tg_graph_epoch++;
+  if (tg_replay) {
+    return;
+  }
+  save_to_log (argc, argv, fmt);
+
+  NEW (e, tg_edit);
+  e->f = f;
+  e->argc = argc;
+  MALLOC (e->argv, char *, argc);
+  for (int i=0; i < argc; i++) {
+    e->argv[i] = Strdup (argv[i]);
+  }
+  if (!_tg_edit_record (e)) {
+    _tg_edit_free (e);
+  }
+}
+
+static void _tg_edit_clear (void)
+{
+  listitem_t *li;
+
+  if (!tg_edits) {
+    return;
+  }
+  for (li = list_first (tg_edits); li; li = list_next (li)) {
+    _tg_edit_free ((tg_edit *) list_value (li));
+  }
+  list_free (tg_edits);
+  hash_free (tg_edit_hash);
+  tg_edits = NULL;
+  tg_edit_hash = NULL;
+}
+
+/*
+ * Return 1 if the timing graph is exactly as built by the pass
+ */
+static int _tg_unedited (TaggedTG *tg)
+{
+  return (!tg_edits || list_isempty (tg_edits)) && A_LEN (tg_vedits) == 0 &&
+    tg->numConstraints () == tg_pass_ncons;
+}
+
+/*
+ * Hash of the timing graph as built by the pass: the vertices and
+ * their names, the edges, and the first <ncons> constraints.
+ */
+static unsigned long _tg_hash (TaggedTG *tg, int ncons)
+{
+  unsigned long h = 14695981039346656037UL;
+  int nv = tg->numVertices ();
+
+#define TG_HASH(x) do { h ^= (unsigned long)(x); h *= 1099511628211UL; } while (0)
+  TG_HASH (nv);
+  for (int vid = 0; vid < nv; vid++) {
+    AGvertexFwdIter fw(tg, vid);
+    TG_HASH (vid);
+    TimingVertexInfo *vi = (TimingVertexInfo *) tg->getVertex (vid)->getInfo();
+    char *nm = vi ? (char *)vi->info() : NULL;
+    if (nm) {
+      for (char *t = nm; *t; t++) {
+	TG_HASH (*t);
+      }
+      FREE (nm);
+    }
+    TG_HASH (0);
+    for (fw = fw.begin(); fw != fw.end(); fw++) {
+      TG_HASH ((*fw)->dst);
+    }
+  }
+  TG_HASH (ncons);
+  for (int i=0; i < ncons; i++) {
+    TaggedTG::constraint *c = tg->getConstraint (i);
+    TG_HASH (c->root);
+    TG_HASH (c->from);
+    TG_HASH (c->to);
+    TG_HASH (c->margin);
+    TG_HASH (c->from_tick | (c->to_tick << 1) | (c->iso << 2));
+    TG_HASH ((c->root_dir & 3) | ((c->from_dir & 3) << 2) |
+	     ((c->to_dir & 3) << 4));
+  }
+#undef TG_HASH
+  return h;
+}
+
 /*------------------------------------------------------------------------
  *
  *  Read liberty file, return handle
  *
  *------------------------------------------------------------------------
  */
-static void *read_lib_file (const char *file)
+
+/*
+ * Liberty files already parsed in this session, identified by the
+ * file itself (device, inode, size, modification time). A read with
+ * -reuse of an unchanged file returns the handle from an earlier read
+ * instead of parsing it again; <nref> counts the reads sharing the
+ * handle. This lives in memory only; nothing is cached on disk.
+ */
+struct lib_cache_entry {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  void *lib;
+  int lh;
+  int nref;
+};
+
+static A_DECL (lib_cache_entry, lib_cache);
+
+static lib_cache_entry *_lib_cache_find (struct stat *st)
+{
+  for (int i=0; i < A_LEN (lib_cache); i++) {
+    if (lib_cache[i].dev == st->st_dev && lib_cache[i].ino == st->st_ino &&
+	lib_cache[i].size == st->st_size && lib_cache[i].mtime == st->st_mtime) {
+      return &lib_cache[i];
+    }
+  }
+  return NULL;
+}
+
+static lib_cache_entry *_lib_cache_find_lib (void *lib)
+{
+  for (int i=0; i < A_LEN (lib_cache); i++) {
+    if (lib_cache[i].lib == lib) {
+      return &lib_cache[i];
+    }
+  }
+  return NULL;
+}
+
+static void _lib_cache_add (struct stat *st, void *lib, int lh)
+{
+  A_NEW (lib_cache, lib_cache_entry);
+  A_NEXT (lib_cache).dev = st->st_dev;
+  A_NEXT (lib_cache).ino = st->st_ino;
+  A_NEXT (lib_cache).size = st->st_size;
+  A_NEXT (lib_cache).mtime = st->st_mtime;
+  A_NEXT (lib_cache).lib = lib;
+  A_NEXT (lib_cache).lh = lh;
+  A_NEXT (lib_cache).nref = 1;
+  A_INC (lib_cache);
+}
+
+/* -- a merged handle no longer corresponds to a single file -- */
+static void _lib_cache_drop (void *lib)
+{
+  int j = 0;
+  for (int i=0; i < A_LEN (lib_cache); i++) {
+    if (lib_cache[i].lib != lib) {
+      lib_cache[j++] = lib_cache[i];
+    }
+  }
+  A_LEN (lib_cache) = j;
+}
+
+static void *read_lib_file (const char *file, int *lh, int reuse)
 {
+  struct stat st;
+  lib_cache_entry *c;
+
   init();
-  
-  FILE *fp = fopen (file, "r");
-  if (!fp) {
+
+  if (stat (file, &st) != 0) {
     return NULL;
   }
-  fclose (fp);
+  if (reuse && (c = _lib_cache_find (&st))) {
+    c->nref++;
+    *lh = c->lh;
+    return c->lib;
+  }
 
   galois::eda::liberty::CellLib *lib = new galois::eda::liberty::CellLib;
   if (lib->parse(file)) {
+     *lh = ptr_register ("liberty", lib);
+     _lib_cache_add (&st, lib, *lh);
      return (void *)lib;
   }
   else {
@@ -102,24 +559,154 @@ static void *read_lib_file (const char *file)
 int process_read_lib (int argc, char **argv)
 {
   void *lib;
-  if (argc != 2) {
-    fprintf (stderr, "Usage: %s <liberty-file>\n", argv[0]);
+  int lh;
+  int reuse = 0;
+  if (argc == 3 && strcmp (argv[1], "-reuse") == 0) {
+    reuse = 1;
+  }
+  if (argc != 2 + reuse) {
+    fprintf (stderr, "Usage: %s [-reuse] <liberty-file>\n", argv[0]);
     return LISP_RET_ERROR;
   }
 
-  lib = read_lib_file (argv[1]);
+  lib = read_lib_file (argv[1+reuse], &lh, reuse);
   if (!lib) {
-    fprintf (stderr, "%s: could not open liberty file `%s'\n", argv[0], argv[1]);
+    fprintf (stderr, "%s: could not open liberty file `%s'\n", argv[0],
+	     argv[1+reuse]);
     return LISP_RET_ERROR;
   }
-  save_to_log (argc, argv, "s");
+  save_to_log (argc, argv, "s*");
 
-  LispSetReturnInt (ptr_register ("liberty", lib));
+  LispSetReturnInt (lh);
 
   return LISP_RET_INT;
 }
 
 
+/*------------------------------------------------------------------------
+ *
+ *  Read several liberty files; returns a list of handles, one per
+ *  file, in argument order. All the files are checked before any of
+ *  them is parsed, and nothing is registered unless all parse.
+ *
+ *------------------------------------------------------------------------
+ */
+static int process_read_lib_many (int argc, char **argv)
+{
+  struct stat *st;
+  int *lh, *src;
+  galois::eda::liberty::CellLib **libs;
+  double *ms;
+  int ok = 1;
+  int reuse = 0;
+
+  if (argc > 1 && strcmp (argv[1], "-reuse") == 0) {
+    reuse = 1;
+  }
+  if (argc < 2 + reuse) {
+    fprintf (stderr, "Usage: %s [-reuse] <liberty-file> ...\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  init ();
+
+  MALLOC (st, struct stat, argc);
+  MALLOC (lh, int, argc);
+  MALLOC (src, int, argc);
+  MALLOC (libs, galois::eda::liberty::CellLib *, argc);
+  MALLOC (ms, double, argc);
+
+  /* -- check every file before parsing any of them -- */
+  for (int i=0; i < argc; i++) {
+    libs[i] = NULL;
+  }
+  for (int i=1+reuse; i < argc; i++) {
+    lib_cache_entry *c;
+    src[i] = i;
+    ms[i] = 0;
+    if (stat (argv[i], &st[i]) != 0) {
+      fprintf (stderr, "%s: liberty file `%s' not found!\n", argv[0], argv[i]);
+      ok = 0;
+      continue;
+    }
+    if (!reuse) {
+      continue;
+    }
+    if ((c = _lib_cache_find (&st[i]))) {
+      lh[i] = c->lh;
+      src[i] = 0;
+      continue;
+    }
+    /* -- same file named twice -- */
+    for (int j=1+reuse; j < i; j++) {
+      if (src[j] == j && st[j].st_dev == st[i].st_dev &&
+	  st[j].st_ino == st[i].st_ino) {
+	src[i] = j;
+	break;
+      }
+    }
+  }
+
+  if (ok) {
+    /* -- CellLib::parse is not known to be reentrant: one at a time -- */
+    for (int i=1+reuse; i < argc; i++) {
+      if (src[i] != i) continue;
+      double t = realtime_msec ();
+      libs[i] = new galois::eda::liberty::CellLib;
+      if (!libs[i]->parse (argv[i])) {
+	delete libs[i];
+	libs[i] = NULL;
+      }
+      ms[i] = realtime_msec () - t;
+    }
+
+    for (int i=1+reuse; i < argc; i++) {
+      if (src[i] == i && !libs[i]) {
+	fprintf (stderr, "%s: could not open liberty file `%s'\n", argv[0],
+		 argv[i]);
+	ok = 0;
+      }
+    }
+  }
+
+  if (!ok) {
+    for (int i=1+reuse; i < argc; i++) {
+      if (libs[i]) {
+	delete libs[i];
+      }
+    }
+  }
+  else {
+    /* -- register in argument order -- */
+    for (int i=1+reuse; i < argc; i++) {
+      if (src[i] == i) {
+	lh[i] = ptr_register ("liberty", libs[i]);
+	_lib_cache_add (&st[i], libs[i], lh[i]);
+	printf ("%s: `%s' parsed in %.3f s\n", argv[0], argv[i], ms[i]/1000.0);
+      }
+      else {
+	if (src[i] != 0) {
+	  lh[i] = lh[src[i]];
+	}
+	_lib_cache_find_lib (ptr_get ("liberty", lh[i]))->nref++;
+      }
+    }
+    save_to_log (argc, argv, "s*");
+    LispSetReturnListStart ();
+    for (int i=1+reuse; i < argc; i++) {
+      LispAppendReturnInt (lh[i]);
+    }
+    LispSetReturnListEnd ();
+  }
+  FREE (st);
+  FREE (lh);
+  FREE (src);
+  FREE (libs);
+  FREE (ms);
+
+  return ok ? LISP_RET_LIST : LISP_RET_ERROR;
+}
+
+
 /*------------------------------------------------------------------------
  *
  *  Read in a .lib file for timing/power analysis
@@ -149,7 +736,14 @@ int process_merge_lib (int argc, char **argv)
     return LISP_RET_ERROR;
   }
   fclose (fp);
+
+  lib_cache_entry *c = _lib_cache_find_lib (cl);
+  if (c && c->nref > 1) {
+    fprintf (stderr, "%s: liberty file handle (%d) is shared by %d reads with -reuse; read the file without -reuse to merge into it\n", argv[0], lh, c->nref);
+    return LISP_RET_ERROR;
+  }
   
+  _lib_cache_drop (cl);
   cl->parse (argv[2]);
 
   save_to_log (argc, argv, "s");
@@ -297,29 +891,309 @@ static ActId *is_arrayed_boolean (char *cmd, char *name, Array **aref)
  *
  *------------------------------------------------------------------------
  */
-static int process_timer_build (int argc, char **argv)
+/*
+ * Timing graph file, in text so that it does not depend on the word
+ * size or byte order of the machine that wrote it:
+ *
+ *   ACTTG 2
+ *   hash <fresh-graph hash, hex>
+ *   journal <n>           then per edit: <kind> <argc> <len>:<arg> ...
+ *   edits <n>             then per edit: <kind> <v1> <v2>
+ *   constraints <n>       then per constraint: root from to margin
+ *                                              flags root_dir from_dir to_dir
+ *   end
+ *
+ * The command journal is kept so that edits can be replayed after
+ * netlist changes. Arguments are length-prefixed, so they can hold
+ * any character.
+ */
+#define TG_FILE_MAGIC "ACTTG"
+#define TG_FILE_VERSION 2
+
+static int _tg_save (FILE *fp, TaggedTG *tg)
 {
-  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
-    return LISP_RET_ERROR;
-  }
-  if (!F.act_toplevel) {
-    fprintf (stderr, "%s: need top level of design set\n", argv[0]);
-    return LISP_RET_ERROR;
+  listitem_t *li;
+
+  fprintf (fp, "%s %d\n", TG_FILE_MAGIC, TG_FILE_VERSION);
+  fprintf (fp, "hash %lx\n", tg_build_hash);
+
+  fprintf (fp, "journal %d\n", tg_edits ? list_length (tg_edits) : 0);
+  if (tg_edits) {
+    for (li = list_first (tg_edits); li; li = list_next (li)) {
+      tg_edit *e = (tg_edit *) list_value (li);
+      int kind = (e->f == process_timer_tick ? 0 :
+		  (e->f == process_timer_cut ? 1 : 2));
+      fprintf (fp, "%d %d", kind, e->argc);
+      for (int i=0; i < e->argc; i++) {
+	fprintf (fp, " %lu:%s", (unsigned long) strlen (e->argv[i]),
+		 e->argv[i]);
+      }
+      fprintf (fp, "\n");
+    }
   }
 
-  ActPass *ap = F.act_design->pass_find ("taggedTG");
-
-  if (!ap) {
-    fprintf (stderr, "%s: no timing graph construction pass found\n", argv[0]);
-    return LISP_RET_ERROR;
+  fprintf (fp, "edits %d\n", A_LEN (tg_vedits));
+  for (int i=0; i < A_LEN (tg_vedits); i++) {
+    fprintf (fp, "%d %d %d\n", tg_vedits[i].kind, tg_vedits[i].v1,
+	     tg_vedits[i].v2);
   }
 
-  F.tp = dynamic_cast<ActDynamicPass *> (ap);
-  Assert (F.tp, "Hmm");
-
-  /* -- create timing graph -- */
-  if (!F.tp->completed()) {
-    F.tp->run (F.act_toplevel);
+  /* -- constraints from the pass are re-created by the pass -- */
+  fprintf (fp, "constraints %d\n", tg->numConstraints() - tg_pass_ncons);
+  for (int i=tg_pass_ncons; i < tg->numConstraints(); i++) {
+    TaggedTG::constraint *c = tg->getConstraint (i);
+    fprintf (fp, "%d %d %d %d %d %d %d %d\n", c->root, c->from, c->to,
+	     c->margin, c->from_tick | (c->to_tick << 1) | (c->iso << 2),
+	     (int)c->root_dir, (int)c->from_dir, (int)c->to_dir);
+  }
+  fprintf (fp, "end\n");
+  return !ferror (fp);
+}
+
+/*
+ * Read "<tag> <n>" with n >= 0
+ */
+static int _tg_read_count (FILE *fp, const char *tag, int *n)
+{
+  char buf[16];
+  return fscanf (fp, "%15s %d", buf, n) == 2 && strcmp (buf, tag) == 0 &&
+    *n >= 0;
+}
+
+struct tg_file_cons {
+  int root, from, to, margin;
+  int flags;
+  int rdir, fdir, tdir;
+};
+
+/*
+ * Apply a saved timing graph file to <tg>, which must be the graph as
+ * built by the pass. The whole file is read and checked first, so a
+ * bad file leaves the graph unchanged.
+ */
+static int _tg_load (const char *cmd, FILE *fp, TaggedTG *tg)
+{
+  char magic[8];
+  int version;
+  unsigned long h;
+  long fsize;
+  int n;
+  int ok = 1;
+  int nv = tg->numVertices ();
+  list_t *journal = list_new ();
+  listitem_t *li;
+  A_DECL (tg_vedit, ve);
+  A_DECL (tg_file_cons, cons);
+
+  /* -- no count or length in the file can exceed its size -- */
+  if (fseek (fp, 0, SEEK_END) != 0 || (fsize = ftell (fp)) < 0 ||
+      fseek (fp, 0, SEEK_SET) != 0) {
+    fprintf (stderr, "%s: cannot read timing graph file\n", cmd);
+    list_free (journal);
+    return 0;
+  }
+
+  if (fscanf (fp, "%7s %d", magic, &version) != 2 ||
+      strcmp (magic, TG_FILE_MAGIC) != 0) {
+    fprintf (stderr, "%s: not a timing graph file\n", cmd);
+    list_free (journal);
+    return 0;
+  }
+  if (version != TG_FILE_VERSION) {
+    fprintf (stderr, "%s: timing graph file version %d; expected %d\n", cmd,
+	     version, TG_FILE_VERSION);
+    list_free (journal);
+    return 0;
+  }
+  if (fscanf (fp, " hash %lx", &h) != 1) {
+    fprintf (stderr, "%s: truncated timing graph file\n", cmd);
+    list_free (journal);
+    return 0;
+  }
+  if (h != tg_build_hash) {
+    fprintf (stderr, "%s: timing graph file does not match the design\n", cmd);
+    list_free (journal);
+    return 0;
+  }
+
+  A_INIT (ve);
+  A_INIT (cons);
+
+  /* -- command journal -- */
+  ok = _tg_read_count (fp, "journal", &n) && n <= fsize;
+  for (int i=0; ok && i < n; i++) {
+    int kind, argc;
+    tg_edit *e;
+
+    ok = fscanf (fp, "%d %d", &kind, &argc) == 2 &&
+      kind >= 0 && kind <= 2 && argc > 0 && argc <= fsize;
+    if (!ok) break;
+
+    NEW (e, tg_edit);
+    e->f = (kind == 0 ? process_timer_tick :
+	    (kind == 1 ? process_timer_cut : process_timer_addconstraint));
+    e->argc = 0;
+    MALLOC (e->argv, char *, argc);
+    list_append (journal, e);
+    for (int j=0; ok && j < argc; j++) {
+      long len;
+      ok = fscanf (fp, " %ld:", &len) == 1 && len >= 0 && len <= fsize;
+      if (!ok) break;
+      MALLOC (e->argv[j], char, len+1);
+      e->argc++;
+      ok = (fread (e->argv[j], 1, len, fp) == (size_t)len);
+      e->argv[j][len] = '\0';
+    }
+  }
+
+  /* -- ticks and cuts -- */
+  ok = ok && _tg_read_count (fp, "edits", &n);
+  for (int i=0; ok && i < n; i++) {
+    tg_vedit x;
+    ok = fscanf (fp, "%d %d %d", &x.kind, &x.v1, &x.v2) == 3 &&
+      (x.kind == TG_VEDIT_TICK || x.kind == TG_VEDIT_CUT) &&
+      x.v1 >= 0 && x.v1 < nv && x.v2 >= 0 && x.v2 < nv;
+    if (ok) {
+      A_NEW (ve, tg_vedit);
+      A_NEXT (ve) = x;
+      A_INC (ve);
+    }
+  }
+
+  /* -- user constraints -- */
+  ok = ok && _tg_read_count (fp, "constraints", &n);
+  for (int i=0; ok && i < n; i++) {
+    tg_file_cons x;
+    ok = fscanf (fp, "%d %d %d %d %d %d %d %d", &x.root, &x.from, &x.to,
+		 &x.margin, &x.flags, &x.rdir, &x.fdir, &x.tdir) == 8 &&
+      x.root >= 0 && x.root < nv && x.from >= 0 && x.from < nv &&
+      x.to >= 0 && x.to < nv;
+    if (ok) {
+      A_NEW (cons, tg_file_cons);
+      A_NEXT (cons) = x;
+      A_INC (cons);
+    }
+  }
+
+  if (ok) {
+    char buf[4];
+    ok = fscanf (fp, "%3s", buf) == 1 && strcmp (buf, "end") == 0;
+  }
+
+  if (!ok) {
+    fprintf (stderr, "%s: truncated or corrupt timing graph file\n", cmd);
+    for (li = list_first (journal); li; li = list_next (li)) {
+      _tg_edit_free ((tg_edit *) list_value (li));
+    }
+    list_free (journal);
+    A_FREE (ve);
+    A_FREE (cons);
+    return 0;
+  }
+
+  /* -- everything checked; now apply it -- */
+  for (li = list_first (journal); li; li = list_next (li)) {
+    tg_edit *e = (tg_edit *) list_value (li);
+    if (!_tg_edit_record (e)) {
+      _tg_edit_free (e);
+    }
+  }
+  list_free (journal);
+
+  for (int i=0; i < A_LEN (ve); i++) {
+    AGvertexFwdIter fw(tg, ve[i].v1);
+    for (fw = fw.begin(); fw != fw.end(); fw++) {
+      AGedge *e = (*fw);
+      if (e->dst != ve[i].v2) continue;
+      TimingEdgeInfo *te = (TimingEdgeInfo *)e->getInfo();
+      if (ve[i].kind == TG_VEDIT_TICK) {
+	te->tickEdge ();
+      }
+      else {
+	te->pruneEdge ();
+      }
+    }
+    _tg_vedit_add (ve[i].kind, ve[i].v1, ve[i].v2);
+  }
+  A_FREE (ve);
+
+  for (int i=0; i < A_LEN (cons); i++) {
+    int cid = tg->addConstraint (cons[i].root, cons[i].from, cons[i].to,
+				 cons[i].margin);
+    TaggedTG::constraint *c = tg->getConstraint (cid);
+    Assert (c, "Hmm");
+    c->from_tick = (cons[i].flags & 1) ? 1 : 0;
+    c->to_tick = (cons[i].flags & 2) ? 1 : 0;
+    c->iso = (cons[i].flags & 4) ? 1 : 0;
+    c->root_dir = cons[i].rdir;
+    c->from_dir = cons[i].fdir;
+    c->to_dir = cons[i].tdir;
+  }
+  A_FREE (cons);
+
+  tg_graph_epoch++;
+  return 1;
+}
+
+static int process_timer_build (int argc, char **argv)
+{
+  if (!std_argcheck (argc == 2 ? 1 : argc, argv, 1, "[file]", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (!F.act_toplevel) {
+    fprintf (stderr, "%s: need top level of design set\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  ActPass *ap = F.act_design->pass_find ("taggedTG");
+
+  if (!ap) {
+    fprintf (stderr, "%s: no timing graph construction pass found\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  F.tp = dynamic_cast<ActDynamicPass *> (ap);
+  Assert (F.tp, "Hmm");
+
+  FILE *fp = NULL;
+  if (argc == 2) {
+    /* -- a graph already built can take the file if it is unedited -- */
+    if (F.tp->completed()) {
+      if (F.timer == TIMER_INIT || F.timer == TIMER_RUN) {
+	fprintf (stderr, "%s: timer already initialized\n", argv[0]);
+	return LISP_RET_ERROR;
+      }
+      if (!tg_build_hash ||
+	  !_tg_unedited ((TaggedTG *) F.tp->getMap (F.act_toplevel))) {
+	fprintf (stderr, "%s: timing graph already built and edited\n",
+		 argv[0]);
+	return LISP_RET_ERROR;
+      }
+    }
+    fp = fopen (argv[1], "r");
+    if (!fp) {
+      fprintf (stderr, "%s: file `%s' not found\n", argv[0], argv[1]);
+      return LISP_RET_ERROR;
+    }
+  }
+
+  /* -- create timing graph -- */
+  if (!F.tp->completed()) {
+    F.tp->run (F.act_toplevel);
+    _tg_edit_clear ();
+    A_FREE (tg_vedits);
+    tg_graph_epoch++;
+    TaggedTG *tg = (TaggedTG *) F.tp->getMap (F.act_toplevel);
+    tg_pass_ncons = tg->numConstraints ();
+    tg_build_hash = _tg_hash (tg, tg_pass_ncons);
+  }
+
+  if (fp) {
+    int ok = _tg_load (argv[0], fp, (TaggedTG *) F.tp->getMap (F.act_toplevel));
+    fclose (fp);
+    if (!ok) {
+      return LISP_RET_ERROR;
+    }
   }
 
   save_to_log (argc, argv, "s");
@@ -340,6 +1214,10 @@ static int process_timer_tick (int argc, char **argv)
     fprintf (stderr, "%s: need to mark edges before running the timer.\n", argv[0]);
     return LISP_RET_ERROR;
   }
+  if (whatif_active && !tg_replay) {
+    fprintf (stderr, "%s: timing graph edits cannot be undone; not allowed in a what-if sandbox\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
 
   int dir1, dir2;
   int len1, len2;
@@ -407,7 +1285,8 @@ static int process_timer_tick (int argc, char **argv)
 	     argv[1], argv[2]);
     return LISP_RET_ERROR;
   }
-  save_to_log (argc, argv, "s*");
+  _tg_vedit_add (TG_VEDIT_TICK, vid1, vid2);
+  _tg_edit_done (process_timer_tick, argc, argv, "s*");
   
   return LISP_RET_TRUE;
 }
@@ -425,6 +1304,10 @@ static int process_timer_cut (int argc, char **argv)
     fprintf (stderr, "%s: need to edit edges before running the timer.\n", argv[0]);
     return LISP_RET_ERROR;
   }
+  if (whatif_active && !tg_replay) {
+    fprintf (stderr, "%s: timing graph edits cannot be undone; not allowed in a what-if sandbox\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
 
   int dir1, dir2;
   int len1, len2;
@@ -492,7 +1375,8 @@ static int process_timer_cut (int argc, char **argv)
 	     argv[1], argv[2]);
     return LISP_RET_ERROR;
   }
-  save_to_log (argc, argv, "s*");
+  _tg_vedit_add (TG_VEDIT_CUT, vid1, vid2);
+  _tg_edit_done (process_timer_cut, argc, argv, "s*");
   
   return LISP_RET_TRUE;
 }
@@ -519,178 +1403,795 @@ static int process_timer_clock (int argc, char **argv)
 
 /*------------------------------------------------------------------------
  *
- *  Create timing graph and push it to the timing analysis engine
+ *  Create the timing analysis engine from the saved liberty handles
  *
  *------------------------------------------------------------------------
  */
-int process_timer_init (int argc, char **argv)
+static ActGaloisTiming *_timer_new (const char *cmd, int nlibs,
+				    galois::eda::model::CellLib **libs)
 {
-  if (!std_argcheck ((argc > 2 ? 2 : argc), argv, 2, "<lib-id1> <lib-id2> ...", STATE_EXPANDED)) {
-    return LISP_RET_ERROR;
-  }
-  if (!F.act_toplevel) {
-    fprintf (stderr, "%s: need top level of design set\n", argv[0]);
-    return LISP_RET_ERROR;
-  }
-
-  /* -- add cell library -- */
-  galois::eda::model::CellLib **libs;
-
-  MALLOC (libs, galois::eda::model::CellLib *, argc-1);
+  ActGaloisTiming *t;
   
-  for (int i=1; i < argc; i++) {
-    libs[i-1] = (galois::eda::model::CellLib *) ptr_get ("liberty", atoi(argv[i]));
-    if (!libs[i-1]) {
-      fprintf (stderr, "%s: timing lib file #%d (`%s') not found\n", argv[0],
-	       i-1, argv[i]);
-      FREE (libs);
-      return LISP_RET_ERROR;
-    }
-  }
-
-  if (agt) {
-    delete agt;
-  }
-
   // allocate Nldm model delay calculator
   auto fn = [](galois::eda::sta::TimingEngine *te) {
     return new galois::eda::liberty::NldmDelayCalculator (te);
   };
   
-  agt = new ActGaloisTiming (F.act_design,
-			     F.act_toplevel,
-			     fn,
-			     argc-1, libs, act_clock_period);
-
-  if (agt->tgError()) {
-    fprintf (stderr, "%s: failed to initialize timer.\n", argv[0]);
-    if (agt->getError()) {
-      fprintf (stderr, " -> %s\n", agt->getError());
+  t = new ActGaloisTiming (F.act_design,
+			   F.act_toplevel,
+			   fn,
+			   nlibs, libs, act_clock_period);
+
+  if (t->tgError()) {
+    fprintf (stderr, "%s: failed to initialize timer.\n", cmd);
+    if (t->getError()) {
+      fprintf (stderr, " -> %s\n", t->getError());
     }
-    return LISP_RET_ERROR;
+    delete t;
+    return NULL;
   }
+  return t;
+}
 
-  F.timer = TIMER_INIT;
-
-  ActPass *ap = F.act_design->pass_find ("taggedTG");
-  if (!ap) {
-    fprintf (stderr, "%s: no timing graph construction pass found\n", argv[0]);
-    return LISP_RET_ERROR;
-  }
-  F.tp = dynamic_cast<ActDynamicPass *> (ap);
-  Assert (F.tp, "Hmm");
+static void _whatif_end (void);
 
+/*
+ * Look up the nets given to set-cap in the current timing graph; nets
+ * that no longer exist are dropped.
+ */
+static void _cap_rebind (const char *cmd)
+{
+  int j = 0;
 
-  save_to_log (argc, argv, "i*");
-  
-  return LISP_RET_TRUE;
+  if (cap_idx) {
+    ihash_free (cap_idx);
+    cap_idx = NULL;
+  }
+  for (int i=0; i < A_LEN (caps); i++) {
+    int vid;
+    if (!get_net_to_timing_vertex ((char *)cmd, caps[i].net, &vid)) {
+      warning ("%s: dropping capacitance on `%s'", cmd, caps[i].net);
+      FREE (caps[i].net);
+      continue;
+    }
+    if (!cap_idx) {
+      cap_idx = ihash_new (16);
+    }
+    caps[j] = caps[i];
+    caps[j].vid = vid;
+    ihash_add (cap_idx, vid)->i = j;
+    j++;
+  }
+  A_LEN (caps) = j;
 }
 
-
-/*------------------------------------------------------------------------
- *
- *  Run the timing analysis engine
- *
- *------------------------------------------------------------------------
+/*
+ * Re-apply SPEF parasitics and set-cap capacitances to a newly created
+ * engine. Returns 1 on success.
  */
-int process_timer_run (int argc, char **argv)
+static int _timer_loads_apply (const char *cmd, ActGaloisTiming *t)
 {
-  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
-    return LISP_RET_ERROR;
+  listitem_t *li;
+
+  if (spef_files) {
+    for (li = list_first (spef_files); li; li = list_next (li)) {
+      const char *file = (const char *) list_value (li);
+      printf ("%s: re-reading SPEF `%s'\n", cmd, file);
+      try {
+	if (!t->readSPEF (file)) {
+	  fprintf (stderr, "%s: could not re-read SPEF `%s'\n", cmd, file);
+	  return 0;
+	}
+      } catch (galois::eda::parasitics::spef_exc &e) {
+	fprintf (stderr, "%s: could not re-read SPEF `%s'\n", cmd, file);
+	return 0;
+      }
+    }
   }
-  if (F.timer == TIMER_NONE) {
-    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
-    return LISP_RET_ERROR;
+  for (int i=0; i < A_LEN (caps); i++) {
+    t->setCap (caps[i].vid, caps[i].val);
   }
+  return 1;
+}
 
-  if (!agt) {
-    fprintf (stderr, "%s: timer needs to be initialized (inconsistency?)\n",
-	     argv[0]);
-    return LISP_RET_ERROR;
+/*
+ * Drop the engines of all corners after a failed (re-)creation, so no
+ * corner is left with a stale or half-loaded engine.
+ */
+static void _timer_discard (const char *cmd)
+{
+  for (int i=0; i < A_LEN (corners); i++) {
+    if (corners[i].t) {
+      delete corners[i].t;
+      corners[i].t = NULL;
+    }
+    corners[i].run = 0;
   }
+  agt = NULL;
+  F.timer = TIMER_NONE;
+  fprintf (stderr, "%s: timer discarded; use timer:init to re-initialize\n",
+	   cmd);
+}
 
-  if (!agt->runFullTiming ()) {
-    fprintf (stderr, "%s: error running timer\n", argv[0]);
-    if (agt->getError()) {
-      fprintf (stderr, " -> %s\n", agt->getError());
+/*
+ * (Re-)create the engines for all the corners. On failure, the timer is
+ * discarded.
+ */
+static int _timer_create (const char *cmd)
+{
+  agt = NULL;
+  if (whatif_active) {
+    warning ("%s: timer re-created; what-if sandbox closed", cmd);
+    _whatif_end ();
+  }
+  for (int i=0; i < A_LEN (corners); i++) {
+    if (corners[i].t) {
+      delete corners[i].t;
+    }
+    corners[i].run = 0;
+    corners[i].t = _timer_new (cmd, corners[i].nlibs, corners[i].libs);
+    if (!corners[i].t) {
+      if (A_LEN (corners) > 1) {
+	fprintf (stderr, "%s: ... for corner `%s'\n", cmd, corners[i].name);
+      }
+      _timer_discard (cmd);
+      return 0;
     }
-    return LISP_RET_ERROR;
   }
-  save_to_log (argc, argv, "");
+  agt = corners[cur_corner].t;
 
-  F.timer = TIMER_RUN;
+  F.timer = TIMER_INIT;
 
-  double p = 0.0;
-  int M = 0;
+  ActPass *ap = F.act_design->pass_find ("taggedTG");
+  if (!ap) {
+    fprintf (stderr, "%s: no timing graph construction pass found\n", cmd);
+    _timer_discard (cmd);
+    return 0;
+  }
+  F.tp = dynamic_cast<ActDynamicPass *> (ap);
+  Assert (F.tp, "Hmm");
 
-  agt->getPeriod (&p, &M);
+  /* -- parasitics and capacitances carry over to the new engines -- */
+  _cap_rebind (cmd);
+  for (int i=0; i < A_LEN (corners); i++) {
+    if (!_timer_loads_apply (cmd, corners[i].t)) {
+      fprintf (stderr, "%s: parasitics could not be restored\n", cmd);
+      _timer_discard (cmd);
+      return 0;
+    }
+  }
 
-  LispSetReturnListStart ();
-  LispAppendReturnFloat (p);
-  LispAppendReturnInt (M);
-  LispSetReturnListEnd ();
-  
-  return LISP_RET_LIST;
+  return 1;
 }
 
 /*------------------------------------------------------------------------
  *
- *  Read in SPEF file
+ *  Create timing graph and push it to the timing analysis engine
  *
  *------------------------------------------------------------------------
  */
-int process_timer_spef (int argc, char **argv)
+int process_timer_init (int argc, char **argv)
 {
-  if (!std_argcheck (argc, argv, 2, "<file>", STATE_EXPANDED)) {
-    return LISP_RET_ERROR;
-  }
-  if (F.timer == TIMER_NONE) {
-    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
+  if (!std_argcheck ((argc > 2 ? 2 : argc), argv, 2, "<lib-id1> <lib-id2> ...", STATE_EXPANDED)) {
     return LISP_RET_ERROR;
   }
-
-  if (!agt) {
-    fprintf (stderr, "%s: timer needs to be initialized (inconsistency?)\n", argv[0]);
+  if (!F.act_toplevel) {
+    fprintf (stderr, "%s: need top level of design set\n", argv[0]);
     return LISP_RET_ERROR;
   }
 
-  FILE *fp = fopen (argv[1], "r");
-  if (!fp) {
-    fprintf (stderr, "%s: file `%s' not found\n", argv[0], argv[1]);
-    return LISP_RET_ERROR;
-  }
-  fclose (fp);
+  /* -- add cell library -- */
+  galois::eda::model::CellLib **libs;
 
-  try {
-    if (!agt->readSPEF (argv[1])) {
-      fprintf (stderr, "%s: could not read SPEF `%s'\n", argv[0], argv[1]);
-      if (agt->getError()) {
-	fprintf (stderr, " -> %s\n", agt->getError());
-      }
+  MALLOC (libs, galois::eda::model::CellLib *, argc-1);
+  
+  for (int i=1; i < argc; i++) {
+    libs[i-1] = (galois::eda::model::CellLib *) ptr_get ("liberty", atoi(argv[i]));
+    if (!libs[i-1]) {
+      fprintf (stderr, "%s: timing lib file #%d (`%s') not found\n", argv[0],
+	       i-1, argv[i]);
+      FREE (libs);
       return LISP_RET_ERROR;
     }
-  } catch (galois::eda::parasitics::spef_exc &e) {
-    fprintf (stderr, "%s: resetting SPEF information\n", argv[0]);
-    agt->resetSPEF ();
+  }
+
+  _corner_free_all ();
+  _cap_clear ();
+  _spef_clear ();
+  A_INIT (corners);
+  A_NEW (corners, timer_corner);
+  A_NEXT (corners).name = Strdup ("default");
+  A_NEXT (corners).libs = libs;
+  A_NEXT (corners).nlibs = argc-1;
+  A_NEXT (corners).t = NULL;
+  A_NEXT (corners).run = 0;
+  A_INC (corners);
+  cur_corner = 0;
+
+  if (!_timer_create (argv[0])) {
     return LISP_RET_ERROR;
   }
-  save_to_log (argc, argv, "s");
 
+  save_to_log (argc, argv, "i*");
+  
   return LISP_RET_TRUE;
 }
 
-
-
-static double my_round (double d)
+/*
+ * Run timing analysis for every corner. The corners run one after the
+ * other: each run already uses all the Galois worker threads, and the
+ * runtime does not support concurrent top-level parallel loops.
+ */
+static int _timer_run_corners (const char *cmd)
 {
-  d = d*1e5 + 0.5;
-  d = ((int)d)/1.0e5;
-  return d;
+  for (int i=0; i < A_LEN (corners); i++) {
+    ActGaloisTiming *t = corners[i].t;
+    corners[i].run = 0;
+    if (!t->runFullTiming ()) {
+      fprintf (stderr, "%s: error running timer", cmd);
+      if (A_LEN (corners) > 1) {
+	fprintf (stderr, " (corner `%s')", corners[i].name);
+      }
+      fprintf (stderr, "\n");
+      if (t->getError()) {
+	fprintf (stderr, " -> %s\n", t->getError());
+      }
+      F.timer = TIMER_INIT;
+      return 0;
+    }
+    corners[i].run = 1;
+  }
+  timer_epoch++;
+  tg_caps_dirty = 0;
+  F.timer = TIMER_RUN;
+  return 1;
 }
 
-static double my_round_2 (double d)
+/*
+ * Called by the circuit editing commands when the netlist has changed.
+ * The current results are stale; the next timer:run rebuilds the
+ * timer. There is no cheaper path for these edits: the engine has no
+ * call to add or remove pins or arcs of its timing graph, and
+ * incrementalUpdate only propagates changed loads. A cell swap or an
+ * inserted buffer changes the arcs of the graph, so both are handled
+ * as structural edits.
+ */
+void timer_netlist_changed (void)
 {
-  d = d*1e2 + 0.5;
+  if (F.timer == TIMER_NONE || !agt) {
+    return;
+  }
+  tg_netlist_dirty = 1;
+  F.timer = TIMER_INIT;
+  if (whatif_active) {
+    whatif_netlist = 1;
+  }
+}
+
+/*
+ * Return 1 while a what-if sandbox is open; the circuit editing
+ * commands refuse to run then, since netlist edits cannot be undone.
+ */
+int timer_whatif_active (void)
+{
+  return whatif_active;
+}
+
+static int _corner_find (const char *name)
+{
+  for (int i=0; i < A_LEN (corners); i++) {
+    if (strcmp (corners[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Make the named corner current for a query. Returns the previous
+ * corner to be restored with _corner_pop(), or -1 on error.
+ */
+static int _corner_push (const char *cmd, const char *name)
+{
+  int prev = cur_corner;
+  int idx = _corner_find (name);
+  if (idx == -1) {
+    fprintf (stderr, "%s: unknown timing corner `%s'\n", cmd, name);
+    return -1;
+  }
+  if (!corners[idx].run) {
+    fprintf (stderr, "%s: timer needs to be run for corner `%s'\n", cmd, name);
+    return -1;
+  }
+  cur_corner = idx;
+  agt = corners[idx].t;
+  return prev;
+}
+
+static void _corner_pop (int prev)
+{
+  cur_corner = prev;
+  agt = corners[prev].t;
+}
+
+/*
+ * Snapshot of the timing results of the current corner, as flat
+ * arrays indexed by timing vertex id (2*net + dir). Arrival and
+ * required times are stored per iteration at [vid*M + iter]. Entries
+ * for vertices without timing information are NaN, so threshold
+ * scans skip them without a separate test.
+ */
+static struct {
+  unsigned long epoch;
+  ActGaloisTiming *t;		/* engine the snapshot came from */
+  int nv;			/* number of timing vertices */
+  int M;			/* iterations */
+  double *slew;			/* [nv] */
+  double *slack;		/* [nv], worst over iterations */
+  double *arr;			/* [nv*M] */
+  double *req;			/* [nv*M] */
+} tsnap = { 0, NULL, 0, 0, NULL, NULL, NULL, NULL };
+
+static void _snapshot_free (void)
+{
+  if (tsnap.t) {
+    FREE (tsnap.slew);
+    FREE (tsnap.slack);
+    if (tsnap.arr) {
+      FREE (tsnap.arr);
+      FREE (tsnap.req);
+    }
+    tsnap.t = NULL;
+  }
+}
+
+/*
+ * Return 1 if the snapshot is valid for the current results, building
+ * it if needed.
+ */
+static int _snapshot_get (void)
+{
+  TaggedTG *tg;
+  double p;
+  int M;
+
+  if (!agt || F.timer != TIMER_RUN) {
+    return 0;
+  }
+  if (tsnap.t == agt && tsnap.epoch == timer_epoch) {
+    return 1;
+  }
+  _snapshot_free ();
+
+  tg = agt->getTaggedTG ();
+  agt->getPeriod (&p, &M);
+
+  tsnap.nv = tg->numVertices ();
+  tsnap.M = M;
+  MALLOC (tsnap.slew, double, tsnap.nv);
+  MALLOC (tsnap.slack, double, tsnap.nv);
+  if (M > 0) {
+    MALLOC (tsnap.arr, double, (long)tsnap.nv*M);
+    MALLOC (tsnap.req, double, (long)tsnap.nv*M);
+  }
+  else {
+    tsnap.arr = NULL;
+    tsnap.req = NULL;
+  }
+
+  /*
+   * One pass over the vertices. The timing_info for each transition
+   * lives on the stack rather than coming from queryTransition, so
+   * there is no heap object per vertex; its constructor still fills
+   * its own per-iteration arrays, as the engine has no accessor for
+   * the raw arrival/required times.
+   */
+  double nan = std::numeric_limits<double>::quiet_NaN ();
+  for (int vid = 0; vid < tsnap.nv; vid += 2) {
+    TimingVertexInfo *vi = (TimingVertexInfo *) tg->getVertex (vid)->getInfo();
+    for (int dir = 0; dir < 2; dir++) {
+      int idx = vid + dir;
+      ActPin *pin = vi->dummyInfo() ? NULL : agt->tgVertexToPin (vid);
+      if (!pin) {
+	tsnap.slew[idx] = nan;
+	tsnap.slack[idx] = nan;
+	for (int i=0; i < M; i++) {
+	  tsnap.arr[(long)idx*M + i] = nan;
+	  tsnap.req[(long)idx*M + i] = nan;
+	}
+	continue;
+      }
+      timing_info ti (agt, pin, dir);
+      tsnap.slew[idx] = ti.getSlew ();
+      double slk = DBL_MAX;
+      for (int i=0; i < M; i++) {
+	double a = ti.getArrv (i);
+	double r = ti.getReq (i);
+	tsnap.arr[(long)idx*M + i] = a;
+	tsnap.req[(long)idx*M + i] = r;
+	if (r - a < slk) {
+	  slk = r - a;
+	}
+      }
+      tsnap.slack[idx] = (M > 0) ? slk : nan;
+    }
+  }
+  tsnap.t = agt;
+  tsnap.epoch = timer_epoch;
+  return 1;
+}
+
+/*
+ * Rebuild the timing graph and the timer after the netlist has been
+ * edited, re-apply the ticks/cuts/constraints from the command line,
+ * and re-run timing analysis. Returns 1 on success.
+ */
+int timer_retime (void)
+{
+  listitem_t *li;
+  
+  if (!agt || cur_corner == -1 || !F.act_toplevel) {
+    return 0;
+  }
+
+  for (int i=0; i < A_LEN (corners); i++) {
+    delete corners[i].t;
+    corners[i].t = NULL;
+  }
+  agt = NULL;
+  F.timer = TIMER_NONE;
+
+  ActPass *ap = F.act_design->pass_find ("taggedTG");
+  if (!ap) {
+    return 0;
+  }
+  F.tp = dynamic_cast<ActDynamicPass *> (ap);
+  Assert (F.tp, "Hmm");
+  int rebuilt = 0;
+  if (!F.tp->completed()) {
+    F.tp->run (F.act_toplevel);
+    rebuilt = 1;
+  }
+  tg_graph_epoch++;
+
+  /* -- a rebuilt graph only has the pass constraints: re-apply edits -- */
+  TaggedTG *tg = (TaggedTG *) F.tp->getMap (F.act_toplevel);
+  Assert (tg, "What?");
+
+  if (rebuilt) {
+    tg_pass_ncons = tg->numConstraints ();
+    A_FREE (tg_vedits);
+    tg_build_hash = _tg_hash (tg, tg_pass_ncons);
+  }
+  tg_replay = 1;
+  if (tg_edits && rebuilt) {
+    for (li = list_first (tg_edits); li; li = list_next (li)) {
+      tg_edit *e = (tg_edit *) list_value (li);
+      if ((*e->f) (e->argc, e->argv) == LISP_RET_ERROR) {
+	warning ("timer: could not re-apply `%s %s %s' after netlist edits",
+		 e->argv[0], e->argv[1], e->argc > 2 ? e->argv[2] : "");
+      }
+    }
+  }
+  tg_replay = 0;
+
+  if (!_timer_create ("timer")) {
+    return 0;
+  }
+  if (!_timer_run_corners ("timer")) {
+    return 0;
+  }
+  tg_netlist_dirty = 0;
+  return 1;
+}
+
+/*
+ * Return nets whose worst rise/fall slew is at least <limit> (in timer
+ * units), as a list of timer_slew_info pointers owned by the caller.
+ */
+list_t *timer_slew_violations (double limit)
+{
+  list_t *l = list_new ();
+  TaggedTG *tg;
+
+  if (!_snapshot_get ()) {
+    return l;
+  }
+
+  tg = agt->getTaggedTG ();
+  for (int vid = 0; vid < tsnap.nv; vid += 2) {
+    double worst = std::fmax (tsnap.slew[vid], tsnap.slew[vid+1]);
+    if (worst >= limit) {
+      TimingVertexInfo *vi = (TimingVertexInfo *) tg->getVertex (vid)->getInfo();
+      timer_slew_info *si;
+      NEW (si, timer_slew_info);
+      si->net = vi->toActId ();
+      si->slew = worst;
+      Assert (si->net, "What?");
+      list_append (l, si);
+    }
+  }
+  return l;
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Timing corners
+ *
+ *------------------------------------------------------------------------
+ */
+static int process_timer_corner_add (int argc, char **argv)
+{
+  if (!std_argcheck ((argc > 3 ? 3 : argc), argv, 3, "<name> <l1> <l2> ...", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer == TIMER_NONE || !agt) {
+    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (_corner_find (argv[1]) != -1) {
+    fprintf (stderr, "%s: corner `%s' already exists\n", argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  if (!_loads_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
+
+  galois::eda::model::CellLib **libs;
+  MALLOC (libs, galois::eda::model::CellLib *, argc-2);
+  for (int i=2; i < argc; i++) {
+    libs[i-2] = (galois::eda::model::CellLib *) ptr_get ("liberty", atoi(argv[i]));
+    if (!libs[i-2]) {
+      fprintf (stderr, "%s: timing lib file #%d (`%s') not found\n", argv[0],
+	       i-2, argv[i]);
+      FREE (libs);
+      return LISP_RET_ERROR;
+    }
+  }
+
+  ActGaloisTiming *t = _timer_new (argv[0], argc-2, libs);
+  if (!t) {
+    FREE (libs);
+    return LISP_RET_ERROR;
+  }
+
+  if (!_timer_loads_apply (argv[0], t)) {
+    delete t;
+    FREE (libs);
+    return LISP_RET_ERROR;
+  }
+
+  A_NEW (corners, timer_corner);
+  A_NEXT (corners).name = Strdup (argv[1]);
+  A_NEXT (corners).libs = libs;
+  A_NEXT (corners).nlibs = argc-2;
+  A_NEXT (corners).t = t;
+  A_NEXT (corners).run = 0;
+  A_INC (corners);
+
+  /* -- results are only valid once every corner has been run -- */
+  if (F.timer == TIMER_RUN) {
+    F.timer = TIMER_INIT;
+  }
+
+  save_to_log (argc, argv, "si*");
+  
+  return LISP_RET_TRUE;
+}
+
+static int process_timer_corner_set (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 2, "<name>", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer == TIMER_NONE || !agt) {
+    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  int idx = _corner_find (argv[1]);
+  if (idx == -1) {
+    fprintf (stderr, "%s: unknown timing corner `%s'\n", argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  cur_corner = idx;
+  agt = corners[idx].t;
+  save_to_log (argc, argv, "s");
+  
+  return LISP_RET_TRUE;
+}
+
+static int process_timer_corner_list (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer == TIMER_NONE || !agt) {
+    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  LispSetReturnListStart ();
+  for (int i=0; i < A_LEN (corners); i++) {
+    LispAppendListStart ();
+    LispAppendReturnString (corners[i].name);
+    LispAppendReturnInt (i == cur_corner ? 1 : 0);
+    if (corners[i].run) {
+      double p = 0.0;
+      int M = 0;
+      corners[i].t->getPeriod (&p, &M);
+      LispAppendReturnFloat (p);
+      LispAppendReturnInt (M);
+    }
+    LispAppendListEnd ();
+  }
+  LispSetReturnListEnd ();
+
+  return LISP_RET_LIST;
+}
+
+
+/*------------------------------------------------------------------------
+ *
+ *  Run the timing analysis engine
+ *
+ *------------------------------------------------------------------------
+ */
+int process_timer_run (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer == TIMER_NONE) {
+    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  if (!agt) {
+    fprintf (stderr, "%s: timer needs to be initialized (inconsistency?)\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  if (tg_netlist_dirty) {
+    /* -- the engine cannot patch its graph; rebuild and replay -- */
+    printf ("%s: netlist changed; rebuilding the timer\n", argv[0]);
+    if (!timer_retime ()) {
+      fprintf (stderr, "%s: error re-building timer\n", argv[0]);
+      return LISP_RET_ERROR;
+    }
+  }
+  else if (tg_caps_dirty && F.timer == TIMER_RUN) {
+    /* -- only capacitances changed: incremental propagation -- */
+    for (int i=0; i < A_LEN (corners); i++) {
+      corners[i].t->incrementalUpdate ();
+    }
+    timer_epoch++;
+    tg_caps_dirty = 0;
+  }
+  else if (!_timer_run_corners (argv[0])) {
+    return LISP_RET_ERROR;
+  }
+  save_to_log (argc, argv, "");
+
+  double p = 0.0;
+  int M = 0;
+
+  agt->getPeriod (&p, &M);
+
+  LispSetReturnListStart ();
+  LispAppendReturnFloat (p);
+  LispAppendReturnInt (M);
+  LispSetReturnListEnd ();
+  
+  return LISP_RET_LIST;
+}
+
+/*
+ * Put every corner back to the parasitics in the SPEF journal after a
+ * read failed part-way. If the journal cannot be re-read either, all
+ * corners are left without SPEF information.
+ */
+static void _timer_loads_restore (const char *cmd)
+{
+  int ok = 1;
+
+  fprintf (stderr, "%s: restoring previous SPEF information\n", cmd);
+  for (int i=0; i < A_LEN (corners); i++) {
+    corners[i].t->resetSPEF ();
+  }
+  for (int i=0; ok && i < A_LEN (corners); i++) {
+    ok = _timer_loads_apply (cmd, corners[i].t);
+  }
+  if (!ok) {
+    fprintf (stderr, "%s: resetting SPEF information\n", cmd);
+    _spef_clear ();
+    for (int i=0; i < A_LEN (corners); i++) {
+      corners[i].t->resetSPEF ();
+      _timer_loads_apply (cmd, corners[i].t);
+    }
+  }
+}
+
+/*
+ * Read SPEF into every corner. If any corner fails, all of them go back
+ * to the parasitics read before.
+ */
+static int _timer_read_spef (const char *cmd, const char *file)
+{
+  int ret = 1;
+
+  FILE *fp = fopen (file, "r");
+  if (!fp) {
+    fprintf (stderr, "%s: file `%s' not found\n", cmd, file);
+    return 0;
+  }
+  fclose (fp);
+
+  for (int i=0; ret && i < A_LEN (corners); i++) {
+    ActGaloisTiming *t = corners[i].t;
+    try {
+      if (!t->readSPEF (file)) {
+	fprintf (stderr, "%s: could not read SPEF `%s'\n", cmd, file);
+	if (t->getError()) {
+	  fprintf (stderr, " -> %s\n", t->getError());
+	}
+	ret = 0;
+      }
+    } catch (galois::eda::parasitics::spef_exc &e) {
+      fprintf (stderr, "%s: error in SPEF `%s'\n", cmd, file);
+      ret = 0;
+    }
+  }
+  if (!ret) {
+    _timer_loads_restore (cmd);
+  }
+  return ret;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Read in SPEF file
+ *
+ *------------------------------------------------------------------------
+ */
+int process_timer_spef (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 2, "<file>", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer == TIMER_NONE) {
+    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  if (!agt) {
+    fprintf (stderr, "%s: timer needs to be initialized (inconsistency?)\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!_loads_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
+
+  if (!_timer_read_spef (argv[0], argv[1])) {
+    return LISP_RET_ERROR;
+  }
+  _spef_add (argv[1]);
+  save_to_log (argc, argv, "s");
+
+  return LISP_RET_TRUE;
+}
+
+static double my_round (double d)
+{
+  d = d*1e5 + 0.5;
+  d = ((int)d)/1.0e5;
+  return d;
+}
+
+static double my_round_2 (double d)
+{
+  d = d*1e2 + 0.5;
   d = ((int)d)/1.0e2;
   return d;
 }
@@ -875,29 +2376,193 @@ int process_timer_get_fo0 (int argc, char **argv)
   return LISP_RET_LIST;
 }
 
+/* -- propagate pending capacitance changes, if timing has been run -- */
+static void _cap_update (void)
+{
+  if (F.timer != TIMER_RUN || !tg_caps_dirty) {
+    return;
+  }
+  for (int i=0; i < A_LEN (corners); i++) {
+    corners[i].t->incrementalUpdate ();
+  }
+  timer_epoch++;
+  tg_caps_dirty = 0;
+}
+
+static void _whatif_end (void)
+{
+  whatif_active = 0;
+  whatif_netlist = 0;
+  A_FREE (whatif_log);
+}
+
 int process_timer_setcap (int argc, char **argv)
 {
-  if (!std_argcheck (argc, argv, 3, "<net> <val>", STATE_EXPANDED)) {
+  if (!std_argcheck (argc, argv, 3, "<net> <val>", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+
+  if (F.timer != TIMER_INIT && F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be at least initialized\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!_loads_check (argv[0])) {
+    return LISP_RET_ERROR;
+  }
+
+  TaggedTG *tg = (TaggedTG *) F.tp->getMap (F.act_toplevel);
+  Assert (tg, "What?");
+  Assert (agt, "What?!");
+
+  int vid;
+  if (!get_net_to_timing_vertex (argv[0], argv[1], &vid)) {
+    return LISP_RET_ERROR;
+  }
+
+  if (whatif_active) {
+    A_NEW (whatif_log, whatif_edit);
+    A_NEXT (whatif_log).vid = vid;
+    A_NEXT (whatif_log).had = _cap_has (vid);
+    A_NEXT (whatif_log).prev = _cap_get (vid);
+    A_INC (whatif_log);
+  }
+  _cap_set (vid, atof (argv[2]), argv[1]);
+
+  save_to_log (argc, argv, "s");
+
+  LispSetReturnListStart ();
+  LispSetReturnListEnd ();
+  return LISP_RET_LIST;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  What-if sandbox: capacitance changes made between whatif-begin and
+ *  whatif-abort are rolled back with an incremental update
+ *
+ *------------------------------------------------------------------------
+ */
+static int process_timer_whatif_begin (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (whatif_active) {
+    fprintf (stderr, "%s: what-if sandbox already open\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (F.s == STATE_DIRTY) {
+    fprintf (stderr, "%s: netlist edited; run ckt:cell-update first\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
+  _whatif_end ();
+  whatif_active = 1;
+  save_to_log (argc, argv, "");
+  return LISP_RET_TRUE;
+}
+
+static int process_timer_whatif_commit (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (!whatif_active) {
+    fprintf (stderr, "%s: no what-if sandbox open\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  _whatif_end ();
+  save_to_log (argc, argv, "");
+  return LISP_RET_TRUE;
+}
+
+static int process_timer_whatif_abort (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (!whatif_active) {
+    fprintf (stderr, "%s: no what-if sandbox open\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (whatif_netlist) {
+    warning ("%s: netlist edits made in the sandbox are not undone", argv[0]);
+  }
+  for (int i = A_LEN (whatif_log) - 1; i >= 0; i--) {
+    _cap_restore (whatif_log[i].vid, whatif_log[i].had, whatif_log[i].prev);
+  }
+  _whatif_end ();
+  _cap_update ();
+  save_to_log (argc, argv, "");
+  return LISP_RET_TRUE;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Rank candidate capacitance changes: each <net> <val> pair is applied
+ *  on its own, and the worst fork slack after an incremental update is
+ *  returned for each. All capacitances are restored afterwards.
+ *
+ *------------------------------------------------------------------------
+ */
+static int process_timer_whatif_eval (int argc, char **argv)
+{
+  if (argc < 3 || (argc % 2) == 0) {
+    fprintf (stderr, "Usage: %s <net> <val> [<net> <val> ...]\n", argv[0]);
     return LISP_RET_ERROR;
   }
-
-  if (F.timer != TIMER_INIT && F.timer != TIMER_RUN) {
-    fprintf (stderr, "%s: timer needs to be at least initialized\n", argv[0]);
+  if (!std_argcheck (3, argv, 3, "<net> <val> ...", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
     return LISP_RET_ERROR;
   }
 
-  TaggedTG *tg = (TaggedTG *) F.tp->getMap (F.act_toplevel);
-  Assert (tg, "What?");
-  Assert (agt, "What?!");
+  int n = (argc-1)/2;
+  int *vid, *had;
+  double *prev;
 
-  int vid;
-  if (!get_net_to_timing_vertex (argv[0], argv[1], &vid)) {
-    return LISP_RET_ERROR;
+  MALLOC (vid, int, n);
+  MALLOC (had, int, n);
+  MALLOC (prev, double, n);
+  for (int i=0; i < n; i++) {
+    if (!get_net_to_timing_vertex (argv[0], argv[2*i+1], &vid[i])) {
+      FREE (vid);
+      FREE (had);
+      FREE (prev);
+      return LISP_RET_ERROR;
+    }
+    had[i] = _cap_has (vid[i]);
+    prev[i] = _cap_get (vid[i]);
   }
+  save_to_log (argc, argv, "s*");
 
-  agt->setCap (vid, atof (argv[2]));
+  /* -- apply pending changes first, so the baseline is consistent -- */
+  _cap_update ();
 
-  save_to_log (argc, argv, "s");
+  /* -- one update per candidate: the previous one is undone together
+     with applying the next one -- */
+  LispSetReturnListStart ();
+  for (int i=0; i < n; i++) {
+    if (i > 0) {
+      _cap_restore (vid[i-1], had[i-1], prev[i-1]);
+    }
+    _cap_set (vid[i], atof (argv[2*i+2]), argv[2*i+1]);
+    _cap_update ();
+    LispAppendReturnFloat (timer_worst_fork_slack ());
+  }
+  LispSetReturnListEnd ();
+  _cap_restore (vid[n-1], had[n-1], prev[n-1]);
+  _cap_update ();
+
+  FREE (vid);
+  FREE (had);
+  FREE (prev);
 
   return LISP_RET_LIST;
 }
@@ -1119,7 +2784,7 @@ int process_timer_addconstraint (int argc, char **argv)
     
   } while (as[0] && !as[0]->isend());
   
-  save_to_log (argc, argv, "sssi");
+  _tg_edit_done (process_timer_addconstraint, argc, argv, "sssi");
   
 #undef FREE_ON_ERROR  
   
@@ -1209,6 +2874,112 @@ static double _time_print (double amt, char *unit)
   return amt;
 }
 
+/*
+ * Inverted index from timing vertices to the constraints that use them
+ * as root, from, or to, in increasing constraint order. Rebuilt when
+ * the graph or its constraints change.
+ */
+static struct {
+  TaggedTG *tg;
+  unsigned long epoch;
+  int nv;
+  int *off;			/* [nv+1] offsets into cid */
+  int *cid;			/* constraint ids */
+} tg_cidx = { NULL, 0, 0, NULL, NULL };
+
+static void _cidx_build (TaggedTG *tg)
+{
+  if (tg_cidx.tg == tg && tg_cidx.epoch == tg_graph_epoch) {
+    return;
+  }
+  if (tg_cidx.tg) {
+    FREE (tg_cidx.off);
+    FREE (tg_cidx.cid);
+  }
+
+  int nv = tg->numVertices ();
+  int nc = tg->numConstraints ();
+  int *pos;
+
+  tg_cidx.nv = nv;
+  MALLOC (tg_cidx.off, int, nv + 1);
+  MALLOC (pos, int, nv + 1);
+  for (int i=0; i <= nv; i++) {
+    tg_cidx.off[i] = 0;
+  }
+
+#define CIDX_VIDS(c, v)				\
+  int v[3];					\
+  v[0] = (c)->root;				\
+  v[1] = ((c)->from != v[0]) ? (c)->from : -1;	\
+  v[2] = ((c)->to != v[0] && (c)->to != (c)->from) ? (c)->to : -1
+
+  /* -- count, then fill; each constraint once per vertex -- */
+  for (int i=0; i < nc; i++) {
+    TaggedTG::constraint *c = tg->getConstraint (i);
+    CIDX_VIDS (c, v);
+    for (int j=0; j < 3; j++) {
+      if (v[j] >= 0 && v[j] < nv) {
+	tg_cidx.off[v[j]+1]++;
+      }
+    }
+  }
+  for (int i=0; i < nv; i++) {
+    tg_cidx.off[i+1] += tg_cidx.off[i];
+    pos[i] = tg_cidx.off[i];
+  }
+  MALLOC (tg_cidx.cid, int, tg_cidx.off[nv] > 0 ? tg_cidx.off[nv] : 1);
+  for (int i=0; i < nc; i++) {
+    TaggedTG::constraint *c = tg->getConstraint (i);
+    CIDX_VIDS (c, v);
+    for (int j=0; j < 3; j++) {
+      if (v[j] >= 0 && v[j] < nv) {
+	tg_cidx.cid[pos[v[j]]++] = i;
+      }
+    }
+  }
+#undef CIDX_VIDS
+  FREE (pos);
+
+  tg_cidx.tg = tg;
+  tg_cidx.epoch = tg_graph_epoch;
+}
+
+/*
+ * Constraints that involve timing vertex <vid>; returns the number of
+ * constraints, and *cids points into the index.
+ */
+static int _constraints_of (TaggedTG *tg, int vid, int **cids)
+{
+  _cidx_build (tg);
+  if (vid < 0 || vid >= tg_cidx.nv) {
+    *cids = NULL;
+    return 0;
+  }
+  *cids = tg_cidx.cid + tg_cidx.off[vid];
+  return tg_cidx.off[vid+1] - tg_cidx.off[vid];
+}
+
+/*
+ * The engine constraints are sorted by timing graph constraint id;
+ * return the first one at or after <lo> for graph constraint <tg_id>
+ * or later.
+ */
+static int _engine_cid_lower (int lo, int tg_id)
+{
+  int hi = agt->getNumConstraints ();
+  while (lo < hi) {
+    int mid = (lo + hi)/2;
+    if (agt->_getConstraint (mid)->tg_id < tg_id) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
 int process_timer_constraint (int argc, char **argv)
 {
   double wns = 0;
@@ -1267,8 +3038,18 @@ int process_timer_constraint (int argc, char **argv)
   _set_delay_units ();
   double timer_units = agt->getTimeUnits ();
 
+  int *cids = NULL;
+  int ncons;
+  if (vid == -1) {
+    ncons = tg->numConstraints();
+  }
+  else {
+    ncons = _constraints_of (tg, vid, &cids);
+  }
+
   int cyc_id = 0;
-  for (int i=0; i < tg->numConstraints(); i++) {
+  for (int ci=0; ci < ncons; ci++) {
+    int i = cids ? cids[ci] : ci;
     TaggedTG::constraint *c;
     c = tg->getConstraint (i);
     if (vid == -1 || (c->root == vid || c->from == vid || c->to == vid)) {
@@ -1448,11 +3229,9 @@ int process_timer_constraint (int argc, char **argv)
 	to_char = (c->to_dir == 1 ? '+' : '-');
       }
 
-      /* the constraints are sorted by timing graph constraint ID */
+      /* find the first engine constraint for constraint i */
+      cyc_id = _engine_cid_lower (cyc_id, i);
       cyclone_constraint *cyc_c = agt->_getConstraint (cyc_id);
-      while (cyc_c && cyc_c->tg_id < i) {
-	cyc_id++;
-      }
       while (cyc_c && cyc_c->tg_id == i) {
 	int from_vtx, to_vtx;
 	from_vtx = c->from + cyc_c->from_dir;
@@ -1651,6 +3430,67 @@ int process_timer_constraint (int argc, char **argv)
   return LISP_RET_TRUE;
 }
 
+/*------------------------------------------------------------------------
+ *
+ *  Batch query: for each net, the list of constraint ids that use it.
+ *  The ids are those of the timing engine (as used by get-slack,
+ *  get-violations, ...); one timing graph constraint can map to
+ *  several of them.
+ *
+ *------------------------------------------------------------------------
+ */
+static int process_timer_constraints_of (int argc, char **argv)
+{
+  if (argc < 2) {
+    fprintf (stderr, "Usage: %s <net> ...\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!std_argcheck (2, argv, 2, "<net> ...", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (!F.tp || !F.tp->completed()) {
+    fprintf (stderr, "%s: need to build the timing graph!\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (F.timer == TIMER_NONE || !agt) {
+    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  TaggedTG *tg = (TaggedTG *) F.tp->getMap (F.act_toplevel);
+  int nc = agt->getNumConstraints ();
+  int *vid;
+
+  MALLOC (vid, int, argc);
+  for (int i=1; i < argc; i++) {
+    if (!get_net_to_timing_vertex (argv[0], argv[i], &vid[i])) {
+      FREE (vid);
+      return LISP_RET_ERROR;
+    }
+  }
+  save_to_log (argc, argv, "s*");
+
+  LispSetReturnListStart ();
+  for (int i=1; i < argc; i++) {
+    int *cids;
+    int n = _constraints_of (tg, vid[i], &cids);
+    int cid = 0;
+    LispAppendListStart ();
+    for (int j=0; j < n; j++) {
+      if (j > 0 && cids[j] == cids[j-1]) continue;
+      cid = _engine_cid_lower (cid, cids[j]);
+      for (; cid < nc && agt->_getConstraint (cid)->tg_id == cids[j]; cid++) {
+	LispAppendReturnInt (cid);
+      }
+    }
+    LispAppendListEnd ();
+  }
+  LispSetReturnListEnd ();
+  FREE (vid);
+
+  return LISP_RET_LIST;
+}
+
 int process_lib_timeunits (int argc, char **argv)
 {
   if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
@@ -1678,46 +3518,324 @@ static int num_constraint_callback (void)
   return agt->getNumConstraints ();
 }
 
+/*
+ * Performance (cycle time) constraints: each tag is a target period
+ * for one timing corner, with a weight. Its slack is the target minus
+ * the period set by the critical cycle of that corner, and its witness
+ * is that cycle. Both are cached per tag until the results change.
+ */
+struct perf_tag {
+  char *corner;			/* timing corner name */
+  double target;
+  double weight;
+
+  unsigned long epoch;		/* cached results of engine t */
+  ActGaloisTiming *t;
+  double p;			/* period of the corner */
+  std::vector<phydb::ActEdge> *path; /* witness; NULL until needed */
+};
+
+static A_DECL (perf_tag, perf_tags);
+
+/*
+ * Engine of the tag's corner, with the cached period brought up to
+ * date. NULL if the corner no longer exists or has not been run.
+ */
+static ActGaloisTiming *_perf_engine (perf_tag *pt)
+{
+  int idx = _corner_find (pt->corner);
+
+  if (idx == -1 || !corners[idx].run || F.timer != TIMER_RUN) {
+    return NULL;
+  }
+  ActGaloisTiming *t = corners[idx].t;
+  if (pt->t != t || pt->epoch != timer_epoch) {
+    int M;
+    pt->t = t;
+    pt->epoch = timer_epoch;
+    pt->p = 0.0;
+    t->getPeriod (&pt->p, &M);
+    if (pt->path) {
+      delete pt->path;
+      pt->path = NULL;
+    }
+  }
+  return t;
+}
+
 static int num_perf_tags (void)
 {
-  return 1;
+  return A_LEN (perf_tags);
 }
 
 static double get_perf_weight (int id)
 {
-  return 1.0;
+  if (id < 0 || id >= A_LEN (perf_tags)) {
+    return 0.0;
+  }
+  return perf_tags[id].weight;
 }
 
+/* -- in the same units as the fork slacks given to PhyDB -- */
 static double get_perf_slack (int id)
 {
-  return 0.0;
+  ActGaloisTiming *t;
+
+  if (id < 0 || id >= A_LEN (perf_tags) ||
+      !(t = _perf_engine (&perf_tags[id]))) {
+    return 0.0;
+  }
+  _set_delay_units ();
+  return (perf_tags[id].target - perf_tags[id].p)/t->getTimeUnits ();
 }
 
 static void get_violated_perf (std::vector<int> &v)
 {
   v.clear();
+  for (int i=0; i < A_LEN (perf_tags); i++) {
+    if (get_perf_slack (i) < 0) {
+      v.push_back (i);
+    }
+  }
 }
 
 static void get_violated_perf_witness (int id, std::vector<phydb::ActEdge> &path)
 {
-  
+  ActGaloisTiming *t;
+
+  path.clear ();
+  if (id < 0 || id >= A_LEN (perf_tags) ||
+      !(t = _perf_engine (&perf_tags[id]))) {
+    return;
+  }
+  perf_tag *pt = &perf_tags[id];
+  if (!pt->path) {
+    pt->path = new std::vector<phydb::ActEdge>;
+    cyclone::TimingPath cyc = t->getCritCycle ();
+    if (!cyc.empty()) {
+      t->convertPath (cyc, *pt->path, true);
+    }
+  }
+  path = *pt->path;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Add a performance tag: target cycle time for a timing corner (in
+ *  the units of the period returned by timer:run), with an optional
+ *  weight
+ *
+ *------------------------------------------------------------------------
+ */
+static int process_timer_perf_add (int argc, char **argv)
+{
+  if (!std_argcheck (argc == 4 ? 3 : argc, argv, 3, "<corner> <target> [weight]",
+		     STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer == TIMER_NONE || !agt) {
+    fprintf (stderr, "%s: timer needs to be initialized\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (_corner_find (argv[1]) == -1) {
+    fprintf (stderr, "%s: unknown timing corner `%s'\n", argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  double target = atof (argv[2]);
+  double weight = (argc == 4) ? atof (argv[3]) : 1.0;
+
+  if (target <= 0 || weight < 0) {
+    fprintf (stderr, "%s: target must be positive and weight non-negative\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
+  A_NEW (perf_tags, perf_tag);
+  A_NEXT (perf_tags).corner = Strdup (argv[1]);
+  A_NEXT (perf_tags).target = target;
+  A_NEXT (perf_tags).weight = weight;
+  A_NEXT (perf_tags).epoch = 0;
+  A_NEXT (perf_tags).t = NULL;
+  A_NEXT (perf_tags).p = 0.0;
+  A_NEXT (perf_tags).path = NULL;
+  A_INC (perf_tags);
+
+  save_to_log (argc, argv, "sff");
+
+  LispSetReturnInt (A_LEN (perf_tags) - 1);
+  return LISP_RET_INT;
+}
+
+/*
+ * List performance tags as (corner target weight slack); the slack is
+ * in the units of the target, and only reported once the tag's corner
+ * has been run.
+ */
+static int process_timer_perf_list (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  save_to_log (argc, argv, "");
+
+  LispSetReturnListStart ();
+  for (int i=0; i < A_LEN (perf_tags); i++) {
+    LispAppendListStart ();
+    LispAppendReturnString (perf_tags[i].corner);
+    LispAppendReturnFloat (perf_tags[i].target);
+    LispAppendReturnFloat (perf_tags[i].weight);
+    if (_perf_engine (&perf_tags[i])) {
+      LispAppendReturnFloat (perf_tags[i].target - perf_tags[i].p);
+    }
+    LispAppendListEnd ();
+  }
+  LispSetReturnListEnd ();
+
+  return LISP_RET_LIST;
+}
+
+
+#if defined (FOUND_phydb)
+/*
+ * Witness paths handed to PhyDB, cached per constraint and end (fast or
+ * slow). The engine returns the witnesses of a constraint one at a
+ * time, advancing an internal cursor that goes back to the first
+ * witness when the witnesses are recomputed. The cache records the
+ * sequence and keeps a cursor of its own that follows the same rules,
+ * so the callbacks return what the engine would have returned, and
+ * later passes over the same timing results are served without the
+ * engine. Paths live in one edge arena. Everything is dropped when the
+ * timing results or the top-K settings change.
+ */
+struct witness_seq {
+  int gen;			/* witness generation of engine_pos */
+  int engine_pos;		/* position of the engine cursor */
+  int cursor;			/* next path to hand out */
+  std::vector<int> path;	/* indices into witness_cache.paths */
+};
+
+static struct {
+  unsigned long epoch;
+  ActGaloisTiming *t;
+  int gen;			/* bumped when the engine recomputes
+				   witnesses, which restarts its cursors */
+  iHashtable *H;		/* 2*constraint + end -> witness_seq */
+  std::vector<phydb::ActEdge> arena;
+  std::vector<std::pair<int,int>> paths; /* (start, length) in arena */
+} witness_cache = { 0, NULL, 0, NULL };
+
+static void _witness_cache_clear (void)
+{
+  if (witness_cache.H) {
+    ihash_iter_t it;
+    ihash_bucket_t *b;
+    ihash_iter_init (witness_cache.H, &it);
+    while ((b = ihash_iter_next (witness_cache.H, &it))) {
+      delete (witness_seq *) b->v;
+    }
+    ihash_free (witness_cache.H);
+    witness_cache.H = NULL;
+  }
+  witness_cache.arena.clear ();
+  witness_cache.paths.clear ();
+  witness_cache.t = NULL;
 }
 
+/*
+ * Next witness of <constraint> at the fast (fast = 1) or slow end
+ */
+static void _witness_next (int constraint, int fast,
+			   std::vector<phydb::ActEdge> &path)
+{
+  cyclone_constraint *cyc = agt->_getConstraint (constraint);
+  ihash_bucket_t *b;
+  witness_seq *w;
+
+  path.clear ();
+  if (!cyc || cyc->witness_ready == 0) {
+    /* error */
+    return;
+  }
+  if (witness_cache.t != agt || witness_cache.epoch != timer_epoch) {
+    _witness_cache_clear ();
+    witness_cache.t = agt;
+    witness_cache.epoch = timer_epoch;
+  }
+  if (cyc->witness_ready == 1) {
+    agt->computeWitnesses ();
+    witness_cache.gen++;
+  }
+  if (!witness_cache.H) {
+    witness_cache.H = ihash_new (16);
+  }
+  b = ihash_lookup (witness_cache.H, 2*(unsigned long)constraint + fast);
+  if (!b) {
+    b = ihash_add (witness_cache.H, 2*(unsigned long)constraint + fast);
+    w = new witness_seq;
+    w->gen = witness_cache.gen;
+    w->engine_pos = 0;
+    w->cursor = 0;
+    b->v = w;
+  }
+  else {
+    w = (witness_seq *) b->v;
+  }
+
+  if (w->gen != witness_cache.gen) {
+    /* -- witnesses recomputed: the engine starts again from the first -- */
+    w->gen = witness_cache.gen;
+    w->engine_pos = 0;
+    w->cursor = 0;
+  }
+
+  if (w->cursor == (int)w->path.size()) {
+    /* -- not seen yet: bring the engine cursor here, and fetch -- */
+    while (w->engine_pos < w->cursor) {
+      agt->getNextForkPath (constraint, fast ? true : false);
+      w->engine_pos++;
+    }
+    cyclone::TimingPath p;
+    std::vector<phydb::ActEdge> tmp;
+    p = fast ? agt->getFastEndPaths (constraint) :
+      agt->getSlowEndPaths (constraint);
+    agt->convertPath (p, tmp, true);
+    agt->getNextForkPath (constraint, fast ? true : false);
+    w->engine_pos++;
+
+    w->path.push_back (witness_cache.paths.size());
+    witness_cache.paths.push_back (std::pair<int,int>
+				   (witness_cache.arena.size(), tmp.size()));
+    witness_cache.arena.insert (witness_cache.arena.end(),
+				tmp.begin(), tmp.end());
+  }
+
+  std::pair<int,int> &r = witness_cache.paths[w->path[w->cursor]];
+  path.assign (witness_cache.arena.begin() + r.first,
+	       witness_cache.arena.begin() + r.first + r.second);
+  w->cursor++;
+}
+#endif
 
 static void set_global_topK (int k)
 {
   agt->setTopK (k);
+#if defined (FOUND_phydb)
+  _witness_cache_clear ();
+#endif
 }
 
 static void set_constraint_topK (int id, int k)
 {
   agt->setTopK_id (id, k);
+#if defined (FOUND_phydb)
+  _witness_cache_clear ();
+#endif
 }
 
 
 static void incremental_update_timer (void)
 {
   agt->incrementalUpdate ();
+  timer_epoch++;
 }
 
 /*
@@ -1771,6 +3889,7 @@ static void get_witness_callback (int constraint,
   }
   if (cyc->witness_ready == 1) {
     agt->computeWitnesses ();
+    witness_cache.gen++;
   }
   /* a < b : a should be fast, b should be slow */
   cyclone::TimingPath pa, pb;
@@ -1797,6 +3916,7 @@ static void get_full_witness_callback (int constraint,
   }
   if (cyc->witness_ready == 1) {
     agt->computeWitnesses ();
+    witness_cache.gen++;
   }
   /* a < b : a should be fast, b should be slow */
   cyclone::TimingPath pa, pb;
@@ -1809,48 +3929,17 @@ static void get_full_witness_callback (int constraint,
 }
 
 
-static void get_slow_witness_callback (int constraint,
-				       std::vector<phydb::ActEdge> &path)
-{
-  TaggedTG *tg = agt->getTaggedTG ();
-  cyclone_constraint *cyc = agt->_getConstraint (constraint);
-  if (!cyc) {
-    return;
-  }
-  if (cyc->witness_ready == 0) {
-    /* error */
-    return;
-  }
-  if (cyc->witness_ready == 1) {
-    agt->computeWitnesses ();
-  }
-  /* a < b : a should be fast, b should be slow */
-  cyclone::TimingPath p;
-  p = agt->getSlowEndPaths (constraint);
-  agt->convertPath (p, path, true);
-  agt->getNextForkPath (constraint, false /* slow end */);
-}
-
-static void get_fast_witness_callback (int constraint,
-				       std::vector<phydb::ActEdge> &path)
-{
-  TaggedTG *tg = agt->getTaggedTG ();
-  cyclone_constraint *cyc = agt->_getConstraint (constraint);
-  if (!cyc) {
-    return;
-  }
-  if (cyc->witness_ready == 0) {
-    /* error */
-    return;
-  }
-  if (cyc->witness_ready == 1) {
-    agt->computeWitnesses ();
-  }
+static void get_slow_witness_callback (int constraint,
+				       std::vector<phydb::ActEdge> &path)
+{
   /* a < b : a should be fast, b should be slow */
-  cyclone::TimingPath p;
-  p = agt->getFastEndPaths (constraint);
-  agt->convertPath (p, path, true);
-  agt->getNextForkPath (constraint, true /* fast end */);
+  _witness_next (constraint, 0 /* slow end */, path);
+}
+
+static void get_fast_witness_callback (int constraint,
+				       std::vector<phydb::ActEdge> &path)
+{
+  _witness_next (constraint, 1 /* fast end */, path);
 }
 
 
@@ -1876,72 +3965,218 @@ static int _sortviolationsfn (char *a, char *b)
   }
 }
 
-static void get_violated_constraints (std::vector<int> &violations)
-{
-  int nc = agt->getNumConstraints ();
-  TaggedTG *tg = agt->getTaggedTG ();
+/*
+ * Fork slack of every constraint for the current results of each
+ * corner, cached until the timing results change. The slacks are
+ * computed serially, as getForkSlack is not documented to be safe to
+ * call concurrently.
+ */
+struct fork_slack_cache {
+  unsigned long epoch;
+  ActGaloisTiming *t;
+  int n;
+  double *slack;
+};
 
-  violations.clear();
+static A_DECL (fork_slack_cache, slack_cache); /* indexed by corner */
 
-  A_DECL (_violation_pair, v);
-  A_INIT (v);
-  
-  for (int i=0; i < nc; i++) {
-    double slack = get_worst_slack (i);
-    if (slack < 0) {
-      A_NEW (v, _violation_pair);
-      A_NEXT (v).idx = i;
-      A_NEXT (v).slack = slack;
-      A_INC (v);
+static double *_corner_fork_slacks (int c, int *nc)
+{
+  ActGaloisTiming *t = corners[c].t;
+
+  while (A_LEN (slack_cache) <= c) {
+    A_NEW (slack_cache, fork_slack_cache);
+    A_NEXT (slack_cache).t = NULL;
+    A_NEXT (slack_cache).slack = NULL;
+    A_INC (slack_cache);
+  }
+  fork_slack_cache *sc = &slack_cache[c];
+  if (sc->t != t || sc->epoch != timer_epoch) {
+    int n = t->getNumConstraints ();
+    if (sc->slack) {
+      FREE (sc->slack);
+    }
+    MALLOC (sc->slack, double, n > 0 ? n : 1);
+
+    for (int i=0; i < n; i++) {
+      sc->slack[i] = t->getForkSlack (i);
     }
+
+    sc->n = n;
+    sc->t = t;
+    sc->epoch = timer_epoch;
   }
+  *nc = sc->n;
+  return sc->slack;
+}
 
-  if (A_LEN (v) > 0) {
-    mygenmergesort ((char *)v, sizeof (_violation_pair), A_LEN (v),
-		    _sortviolationsfn);
-    for (int i=0; i < A_LEN (v); i++) {
-      violations.push_back (v[i].idx);
+static double *_fork_slacks (int *nc)
+{
+  return _corner_fork_slacks (cur_corner, nc);
+}
+
+/*
+ * Violated constraints (slack < 0) of the slack array <slk> in order
+ * of increasing slack, ties broken by constraint id, with slacks
+ * multiplied by <scale>. With k > 0, only the k worst are returned,
+ * selected with a bounded heap.
+ */
+static void _worst_of (double *slk, int nc, int k, double scale,
+		       std::vector<std::pair<int,float>> &res)
+{
+  std::vector<std::pair<double,int>> v;
+
+  res.clear ();
+
+  if (k > 0) {
+    std::priority_queue<std::pair<double,int>> heap;
+    for (int i=0; i < nc; i++) {
+      if (slk[i] >= 0) continue;
+      std::pair<double,int> x(slk[i], i);
+      if ((int)heap.size() < k) {
+	heap.push (x);
+      }
+      else if (x < heap.top()) {
+	heap.pop ();
+	heap.push (x);
+      }
+    }
+    while (!heap.empty()) {
+      v.push_back (heap.top());
+      heap.pop ();
+    }
+    std::reverse (v.begin(), v.end());
+  }
+  else {
+    for (int i=0; i < nc; i++) {
+      if (slk[i] < 0) {
+	v.push_back (std::pair<double,int>(slk[i], i));
+      }
     }
+    std::sort (v.begin(), v.end());
   }
 
-  A_FREE (v);
+  for (size_t i=0; i < v.size(); i++) {
+    res.push_back (std::pair<int,float>(v[i].second, v[i].first*scale));
+  }
+}
+
+/* -- violations of the current corner -- */
+static void _worst_violations (int k, double scale,
+			       std::vector<std::pair<int,float>> &res)
+{
+  int nc;
+  double *slk = _fork_slacks (&nc);
+  _worst_of (slk, nc, k, scale, res);
+}
+
+static void get_violated_constraints (std::vector<int> &violations)
+{
+  std::vector<std::pair<int,float>> res;
+
+  _set_delay_units ();
+  _worst_violations (0, 1.0/agt->getTimeUnits(), res);
 
-  return;
+  violations.clear();
+  for (size_t i=0; i < res.size(); i++) {
+    violations.push_back (res[i].first);
+  }
 }
 
 
 static
-void get_violated_constraints2 (std::vector<std::pair<int,float>> &violations)
+void get_violated_constraints2 (std::vector<std::pair<int,float>> &violations,
+				int k = 0)
 {
-  int nc = agt->getNumConstraints ();
-  TaggedTG *tg = agt->getTaggedTG ();
+  _worst_violations (k, 1.0, violations);
+}
 
-  violations.clear();
+/*
+ * Worst fork slack across all timing constraints, or DBL_MAX if there
+ * are none.
+ */
+double timer_worst_fork_slack (void)
+{
+  double wns = DBL_MAX;
+  double *slk;
+  int nc;
+
+  if (!agt || F.timer != TIMER_RUN) {
+    return wns;
+  }
+  slk = _fork_slacks (&nc);
+  for (int i=0; i < nc; i++) {
+    if (slk[i] < wns) {
+      wns = slk[i];
+    }
+  }
+  return wns;
+}
+
+/*
+ * Return the driver pins of the nets on the early ("from") side of
+ * timing forks with slack below <target>, worst fork first, as a list
+ * of strings owned by the caller. Each pin is reported once.
+ */
+list_t *timer_fork_drivers (double target)
+{
+  list_t *l = list_new ();
+
+  if (!agt || F.timer != TIMER_RUN) {
+    return l;
+  }
 
+  int nc;
+  double *slk = _fork_slacks (&nc);
+  TaggedTG *tg = agt->getTaggedTG ();
+  struct Hashtable *H = hash_new (16);
+  
   A_DECL (_violation_pair, v);
   A_INIT (v);
-  
+
   for (int i=0; i < nc; i++) {
-    double slack = agt->getForkSlack (i);
-    if (slack < 0) {
+    double slack = slk[i];
+    if (slack < target) {
       A_NEW (v, _violation_pair);
       A_NEXT (v).idx = i;
       A_NEXT (v).slack = slack;
       A_INC (v);
     }
   }
-
   if (A_LEN (v) > 0) {
     mygenmergesort ((char *)v, sizeof (_violation_pair), A_LEN (v),
 		    _sortviolationsfn);
-    for (int i=0; i < A_LEN (v); i++) {
-      violations.push_back (std::pair<int,float>(v[i].idx, v[i].slack));
-    }
   }
 
-  A_FREE (v);
+  for (int i=0; i < A_LEN (v); i++) {
+    cyclone_constraint *cyc = agt->_getConstraint (v[i].idx);
+    if (!cyc) continue;
+    TaggedTG::constraint *tgc = tg->getConstraint (cyc->tg_id);
+
+    /* -- the driver of the net, not the pin at the fork -- */
+    list_t *dl = agt->queryDriver (tgc->from);
+    if (!dl) continue;
+    timing_info *ti = timer_query_extract_fall (dl);
+    if (!ti) {
+      ti = timer_query_extract_rise (dl);
+    }
+    if (!ti || !ti->pin) {
+      agt->queryFree (dl);
+      continue;
+    }
 
-  return;
+    char buf[10240];
+    ti->pin->sPrintFullName (buf, 10240);
+    agt->queryFree (dl);
+    if (!hash_lookup (H, buf)) {
+      hash_add (H, buf);
+      list_append (l, Strdup (buf));
+    }
+  }
+  A_FREE (v);
+  hash_free (H);
+  
+  return l;
 }
 
 int process_timer_num_constraints (int argc, char **argv)
@@ -1965,9 +4200,18 @@ int process_timer_num_constraints (int argc, char **argv)
 
 int process_timer_get_violations (int argc, char **argv)
 {
-  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
+  int k = 0;
+  
+  if (!std_argcheck (argc == 2 ? 1 : argc, argv, 1, "[k]", STATE_EXPANDED)) {
     return LISP_RET_ERROR;
   }
+  if (argc == 2) {
+    k = atoi (argv[1]);
+    if (k <= 0) {
+      fprintf (stderr, "%s: k must be positive\n", argv[0]);
+      return LISP_RET_ERROR;
+    }
+  }
 
   if (F.timer != TIMER_RUN) {
     fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
@@ -1976,11 +4220,35 @@ int process_timer_get_violations (int argc, char **argv)
 
   std::vector<std::pair<int,float>> res;
 
-  get_violated_constraints2 (res);
-  
+  if (A_LEN (corners) == 1) {
+    get_violated_constraints2 (res, k);
+  }
+  else {
+    /* -- several corners: worst slack over all corners for each cid -- */
+    int nc;
+    double *slk = _corner_fork_slacks (0, &nc);
+    double *worst;
+    MALLOC (worst, double, nc > 0 ? nc : 1);
+    for (int i=0; i < nc; i++) {
+      worst[i] = slk[i];
+    }
+    for (int j=1; j < A_LEN (corners); j++) {
+      int cnc;
+      slk = _corner_fork_slacks (j, &cnc);
+      Assert (cnc == nc, "Corners with different constraints?");
+      for (int i=0; i < nc; i++) {
+	if (slk[i] < worst[i]) {
+	  worst[i] = slk[i];
+	}
+      }
+    }
+    _worst_of (worst, nc, k, 1.0, res);
+    FREE (worst);
+  }
+
   LispSetReturnListStart ();
 
-  for (int i=0; i < res.size(); i++) {
+  for (size_t i=0; i < res.size(); i++) {
     LispAppendListStart ();
     LispAppendReturnInt (res[i].first);
     LispAppendReturnFloat (res[i].second);
@@ -1988,148 +4256,222 @@ int process_timer_get_violations (int argc, char **argv)
   }
 
   LispSetReturnListEnd ();
-  
   return LISP_RET_LIST;
 }
 
 
-static int _path_search (TaggedTG *tg,
-			 AGvertex *root,
-			 AGvertex *v1, int *tick1,
-			 AGvertex *v2, int *tick2,
-			 int tick_limit)
+/*
+ * Forward adjacency of the timing graph in compressed sparse row form,
+ * with a flag per edge for ticked edges. Rebuilt when the graph or its
+ * ticks/cuts change.
+ */
+static struct {
+  TaggedTG *tg;
+  unsigned long epoch;
+  int nv;
+  int *off;			/* [nv+1] edge offsets */
+  int *dst;			/* edge destinations */
+  unsigned char *tick;		/* 1 if the edge is ticked */
+} tg_csr = { NULL, 0, 0, NULL, NULL, NULL };
+
+static void _csr_build (TaggedTG *tg)
 {
-  struct iHashtable *H[2];
-  ihash_bucket_t *b;
-  ihash_iter_t it;
-  int change, cur;
-
-  H[0] = ihash_new (8);
-  H[1] = ihash_new (8);
+  if (tg_csr.tg == tg && tg_csr.epoch == tg_graph_epoch) {
+    return;
+  }
+  if (tg_csr.tg) {
+    FREE (tg_csr.off);
+    if (tg_csr.dst) {
+      FREE (tg_csr.dst);
+      FREE (tg_csr.tick);
+    }
+  }
 
-  b = ihash_add (H[0], root->vid);
-  b->i = 0; // no ticks
+  A_DECL (int, dst);
+  A_DECL (unsigned char, tick);
+  A_INIT (dst);
+  A_INIT (tick);
+
+  tg_csr.nv = tg->numVertices ();
+  MALLOC (tg_csr.off, int, tg_csr.nv + 1);
+  for (int vid = 0; vid < tg_csr.nv; vid++) {
+    tg_csr.off[vid] = A_LEN (dst);
+    AGvertexFwdIter fw(tg, vid);
+    for (fw = fw.begin(); fw != fw.end(); fw++) {
+      AGedge *e = (*fw);
+      TimingEdgeInfo *ei = (TimingEdgeInfo *) e->getInfo();
+      A_NEW (dst, int);
+      A_NEXT (dst) = e->dst;
+      A_INC (dst);
+      A_NEW (tick, unsigned char);
+      A_NEXT (tick) = ei->isTicked() ? 1 : 0;
+      A_INC (tick);
+    }
+  }
+  tg_csr.off[tg_csr.nv] = A_LEN (dst);
+  tg_csr.dst = dst;
+  tg_csr.tick = tick;
+  tg_csr.tg = tg;
+  tg_csr.epoch = tg_graph_epoch;
+}
 
-  cur = 1;
-  int warn = 0;
+/*
+ * Scratch space for a reachability search. mask[v] has bit t set if v
+ * can be reached from the root through exactly t ticked edges.
+ */
+struct reach_scratch {
+  int nv;
+  unsigned int *mask;
+  unsigned long *inq;		/* bitset: vertex is on the worklist */
+  int *work;			/* worklist */
+  int *touched;			/* vertices with a non-zero mask */
+  int ntouched;
+
+  reach_scratch () : nv(0), mask(NULL), inq(NULL), work(NULL),
+		     touched(NULL), ntouched(0) { }
+};
 
-#if 0  
-  int round = 0;
-#endif
-  
-  do {
-    int found = 0;
+#define REACH_WORD (8*sizeof (unsigned long))
+#define REACH_MAXTICKS 31
 
-#if 0    
-    printf ("\n~~~~~~ Round %d ~~~~~~\n", round++);
-#endif
-    
-    ihash_clear (H[cur]);
-    cur = 1 - cur;
-    change = 0;
+static void _reach_scratch_free (reach_scratch *rs)
+{
+  if (rs->nv > 0) {
+    FREE (rs->mask);
+    FREE (rs->inq);
+    FREE (rs->work);
+    FREE (rs->touched);
+    rs->nv = 0;
+  }
+}
 
-    ihash_iter_init (H[cur], &it);
-    while ((b = ihash_iter_next (H[cur], &it))) {
-      int vid = (int) b->key;
+static void _reach_scratch_init (reach_scratch *rs, int nv)
+{
+  if (rs->nv == nv) {
+    return;
+  }
+  _reach_scratch_free (rs);
+  rs->nv = nv;
+  MALLOC (rs->mask, unsigned int, nv);
+  MALLOC (rs->inq, unsigned long, nv/REACH_WORD + 1);
+  MALLOC (rs->work, int, nv);
+  MALLOC (rs->touched, int, nv);
+  memset (rs->mask, 0, sizeof (unsigned int)*nv);
+  memset (rs->inq, 0, sizeof (unsigned long)*(nv/REACH_WORD + 1));
+  rs->ntouched = 0;
+}
 
-#if 0
-      const char *tmp = tg->getVertex (vid)->getInfo()->info();
-      printf ("> %s [ticks=%d]\n", tmp, b->i);
-#endif
+/*
+ * Compute the tick-count masks of all vertices reachable from <root>,
+ * following ticked edges only while the count stays within
+ * <tick_limit>.
+ */
+static void _reach (reach_scratch *rs, int root, int tick_limit)
+{
+  unsigned int lim;
+  int nw;
 
-      if (vid == v1->vid && (b->i == *tick1)) {
-#if 0
-	printf ("  >> found from\n");
-#endif
-	found++;
-      }
-      else if (vid == v1->vid) {
-	//warning (">> found path from root to lhs, tick mismatch");
-      }
+  for (int i=0; i < rs->ntouched; i++) {
+    rs->mask[rs->touched[i]] = 0;
+  }
+  rs->ntouched = 0;
 
-      if (vid == v2->vid && (b->i == *tick2)) {
-#if 0
-	printf ("  >> found to\n");
-#endif
-	found++;
-      }
-      else if (vid == v2->vid) {
-	//warning (">> found path from root to rhs, tick mismatch");
-      }
+  lim = (tick_limit >= REACH_MAXTICKS) ? ~0U : ((1U << (tick_limit+1)) - 1);
 
-      if (found == 2) {
-	ihash_free (H[0]);
-	ihash_free (H[1]);
-	return 0;
-      }
+  rs->mask[root] = 1;
+  rs->touched[rs->ntouched++] = root;
+  rs->work[0] = root;
+  rs->inq[root/REACH_WORD] |= (1UL << (root % REACH_WORD));
+  nw = 1;
 
-      if (!ihash_lookup (H[1-cur], b->key)) {
-	ihash_add (H[1-cur], b->key)->i = b->i;
-      }
-      
-      AGvertexFwdIter fw(tg, vid);
-      for (fw = fw.begin(); fw != fw.end(); fw++) {
-	AGedge *e = (*fw);
-	TimingEdgeInfo *ei = (TimingEdgeInfo *) e->getInfo();
-	ihash_bucket_t *newb;
-	if (ei->isTicked() && (b->i + 1 > tick_limit)) {
-	  // double tick
-#if 0
-	  printf ("  >> pruned %s\n",
-		  tg->getVertex (e->dst)->getInfo()->info());
-#endif
-	  continue;
-	}
+  while (nw > 0) {
+    int v = rs->work[--nw];
+    unsigned int m = rs->mask[v];
+    rs->inq[v/REACH_WORD] &= ~(1UL << (v % REACH_WORD));
 
-#if 0
-	printf ("  >> explore %s [arctick=%d]\n", tg->getVertex (e->dst)->getInfo()->info(), ei->isTicked());
-#endif
-	
-	// did we add this already?
-	newb = ihash_lookup (H[1-cur], e->dst);
-	if (newb) {
-	  if (newb->i != (b->i + ei->isTicked())) {
-	    warn++;
-	    newb->i = MAX(newb->i, b->i + ei->isTicked());
-	  }
+    for (int e = tg_csr.off[v]; e < tg_csr.off[v+1]; e++) {
+      int u = tg_csr.dst[e];
+      unsigned int nm = tg_csr.tick[e] ? ((m << 1) & lim) : m;
+      if (nm & ~rs->mask[u]) {
+	if (!rs->mask[u]) {
+	  rs->touched[rs->ntouched++] = u;
 	}
-	else {
-	  newb = ihash_add (H[1-cur], e->dst);
-	  newb->i = b->i + ei->isTicked();
-	}
-
-	// did it exist alraedy?
-	newb = ihash_lookup (H[cur], e->dst);
-	if (!newb) {
-	  change = 1;
+	rs->mask[u] |= nm;
+	if (!(rs->inq[u/REACH_WORD] & (1UL << (u % REACH_WORD)))) {
+	  rs->inq[u/REACH_WORD] |= (1UL << (u % REACH_WORD));
+	  rs->work[nw++] = u;
 	}
       }
     }
-  } while (change);
+  }
+}
 
-  warn = 0;
-  
-  b = ihash_lookup (H[cur], v1->vid);
-  if (!b) {
-    warn |= 1;
+#define REACH_OK          0
+#define REACH_UNREACHABLE 1
+#define REACH_BADTICKS    2
+
+/*
+ * Status of vertex <v> after _reach(). As with the old path search,
+ * the tick count of a vertex is the largest one over all the paths
+ * that reach it, and the check passes only if that count is the
+ * expected one. On a mismatch, *ticks is set to the count found.
+ */
+static int _reach_status (reach_scratch *rs, int v, int *ticks)
+{
+  unsigned int m = rs->mask[v];
+  if (!m) {
+    return REACH_UNREACHABLE;
   }
-  else if (b->i != *tick1) {
-    *tick1 = b->i;
-    warn |= 2;
+  int t = 0;
+  while (m >>= 1) {
+    t++;
   }
-  b = ihash_lookup (H[cur], v2->vid);
-  if (!b) {
-    warn |= (1 << 2);
+  if (t == *ticks) {
+    return REACH_OK;
   }
-  else if (b->i != *tick2) {
-    *tick2 = b->i;
-    warn |= (2 << 2);
+  *ticks = t;
+  return REACH_BADTICKS;
+}
+
+static const char *_reach_str (int status)
+{
+  switch (status) {
+  case REACH_OK:
+    return "ok";
+  case REACH_UNREACHABLE:
+    return "unreachable";
+  default:
+    return "ticks";
   }
-    
-  ihash_free (H[0]);
-  ihash_free (H[1]);
+}
+
+/*
+ * Timing vertices for the root, fast and slow ends of constraint <cid>.
+ * Returns 0 if the constraint does not exist.
+ */
+static int _constraint_vids (TaggedTG *tg, int cid, int *root, int *from,
+			     int *to)
+{
+  cyclone_constraint *cyc = agt->_getConstraint (cid);
+  if (!cyc) {
+    return 0;
+  }
+  TaggedTG::constraint *tgc = tg->getConstraint (cyc->tg_id);
+  
+  *root = agt->tgVertexToPin (tgc->root)->getNetVertex()->vid + cyc->root_dir;
+  *from = agt->tgVertexToPin (tgc->from)->getNetVertex()->vid + cyc->from_dir;
+  *to = agt->tgVertexToPin (tgc->to)->getNetVertex()->vid + cyc->to_dir;
+  return 1;
+}
 
-  return warn;
+static int _check_tick_limit (const char *cmd, int tick_lim)
+{
+  if (tick_lim < 0 || tick_lim > REACH_MAXTICKS) {
+    fprintf (stderr, "%s: tick limit must be between 0 and %d\n", cmd,
+	     REACH_MAXTICKS);
+    return 0;
+  }
+  return 1;
 }
 
 
@@ -2151,6 +4493,9 @@ int process_timer_check_constraint (int argc, char **argv)
   if (argc == 3) {
     tick_lim = atoi (argv[2]);
   }
+  if (!_check_tick_limit (argv[0], tick_lim)) {
+    return LISP_RET_ERROR;
+  }
 
   cyclone_constraint *cyc = agt->_getConstraint (atoi(argv[1]));
 
@@ -2204,9 +4549,16 @@ int process_timer_check_constraint (int argc, char **argv)
     tov = tg->getVertex (tov->vid + 1);
   }
 
+  reach_scratch rs;
   int tick1 = tgc->from_tick;
   int tick2 = tgc->to_tick;
-  int res = _path_search (tg, rootv, fromv, &tick1, tov, &tick2, tick_lim);
+
+  _csr_build (tg);
+  _reach_scratch_init (&rs, tg_csr.nv);
+  _reach (&rs, rootv->vid, tick_lim);
+  int res = _reach_status (&rs, fromv->vid, &tick1)
+    | (_reach_status (&rs, tov->vid, &tick2) << 2);
+  _reach_scratch_free (&rs);
   if (res) {
     if (res & 0x3) {
       printf (">> could not find path from root to lhs");
@@ -2224,27 +4576,158 @@ int process_timer_check_constraint (int argc, char **argv)
     }
     return LISP_RET_FALSE;
   }
-  return LISP_RET_TRUE;
-}
+  return LISP_RET_TRUE;
+}
+
+
+
+/*
+ * Check that the paths for all timing forks exist; the constraints
+ * are checked in parallel. Returns the failures.
+ */
+int process_timer_check_all_constraints (int argc, char **argv)
+{
+  if (!std_argcheck (argc == 1 ? 2 : argc, argv, 2, "[ticks]", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  int tick_lim = (argc == 2) ? atoi (argv[1]) : 1;
+  if (!_check_tick_limit (argv[0], tick_lim)) {
+    return LISP_RET_ERROR;
+  }
+
+  TaggedTG *tg = (TaggedTG *) F.tp->getMap (F.act_toplevel);
+  int nc = agt->getNumConstraints ();
+
+  /* -- resolve the constraint end points -- */
+  int *vids, *res, *ticks;
+  MALLOC (vids, int, 3*nc + 1);
+  MALLOC (res, int, nc + 1);
+  MALLOC (ticks, int, 2*nc + 1);
+  for (int i=0; i < nc; i++) {
+    if (!_constraint_vids (tg, i, &vids[3*i], &vids[3*i+1], &vids[3*i+2])) {
+      vids[3*i] = -1;
+      continue;
+    }
+    cyclone_constraint *cyc = agt->_getConstraint (i);
+    TaggedTG::constraint *tgc = tg->getConstraint (cyc->tg_id);
+    ticks[2*i] = tgc->from_tick;
+    ticks[2*i+1] = tgc->to_tick;
+  }
+
+  _csr_build (tg);
+
+  galois::substrate::PerThreadStorage<reach_scratch> scratch;
+  galois::do_all (galois::iterate (0, nc),
+		  [&] (int i) {
+		    if (vids[3*i] == -1) {
+		      res[i] = 0;
+		      return;
+		    }
+		    reach_scratch *rs = scratch.getLocal ();
+		    _reach_scratch_init (rs, tg_csr.nv);
+		    _reach (rs, vids[3*i], tick_lim);
+		    res[i] = _reach_status (rs, vids[3*i+1], &ticks[2*i])
+		      | (_reach_status (rs, vids[3*i+2], &ticks[2*i+1]) << 2);
+		  },
+		  galois::steal(),
+		  galois::loopname ("timer-check-constraints"));
+  for (unsigned i=0; i < galois::getActiveThreads(); i++) {
+    _reach_scratch_free (scratch.getRemote (i));
+  }
+
+  LispSetReturnListStart ();
+  for (int i=0; i < nc; i++) {
+    if (res[i] == 0) continue;
+    LispAppendListStart ();
+    LispAppendReturnInt (i);
+    LispAppendReturnString (_reach_str (res[i] & 0x3));
+    LispAppendReturnInt (ticks[2*i]);
+    LispAppendReturnString (_reach_str (res[i] >> 2));
+    LispAppendReturnInt (ticks[2*i+1]);
+    LispAppendListEnd ();
+  }
+  LispSetReturnListEnd ();
+
+  FREE (vids);
+  FREE (res);
+  FREE (ticks);
+
+  return LISP_RET_LIST;
+}
+
+int process_timer_get_slack (int argc, char **argv)
+{
+  int prev = -1;
+  
+  if (!std_argcheck (argc == 3 ? 2 : argc, argv, 2, "cid [corner]", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  if (argc == 3 && (prev = _corner_push (argv[0], argv[2])) == -1) {
+    return LISP_RET_ERROR;
+  }
+
+  LispSetReturnFloat (agt->getForkSlack (atoi (argv[1])));
+
+  if (prev != -1) {
+    _corner_pop (prev);
+  }
 
+  return LISP_RET_FLOAT;
+}
 
 
-int process_timer_get_slack (int argc, char **argv)
+static int process_timer_save_graph (int argc, char **argv)
 {
-  if (!std_argcheck (argc, argv, 2, "cid", STATE_EXPANDED)) {
+  if (!std_argcheck (argc, argv, 2, "<file>", STATE_EXPANDED)) {
     return LISP_RET_ERROR;
   }
 
-  if (F.timer != TIMER_RUN) {
-    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+  if (!F.tp || !F.tp->completed()) {
+    fprintf (stderr, "%s: need to build the timing graph!\n", argv[0]);
     return LISP_RET_ERROR;
   }
 
-  LispSetReturnFloat (agt->getForkSlack (atoi (argv[1])));
+  TaggedTG *tg = (TaggedTG *) F.tp->getMap (F.act_toplevel);
+  if (!tg) {
+    fprintf (stderr, "%s: no timing graph\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (!tg_build_hash) {
+    fprintf (stderr, "%s: timing graph was not built by timer:build-graph\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
 
-  return LISP_RET_FLOAT;
-}
+  FILE *fp = fopen (argv[1], "w");
+  if (!fp) {
+    fprintf (stderr, "%s: could not open file `%s' for writing\n", argv[0],
+	     argv[1]);
+    return LISP_RET_ERROR;
+  }
+  int ok = _tg_save (fp, tg);
+  if (fclose (fp) != 0) {
+    ok = 0;
+  }
+  if (!ok) {
+    fprintf (stderr, "%s: error writing `%s'\n", argv[0], argv[1]);
+    return LISP_RET_ERROR;
+  }
+  save_to_log (argc, argv, "s");
 
+  return LISP_RET_TRUE;
+}
 
 int process_timer_save (int argc, char **argv)
 {
@@ -2375,8 +4858,9 @@ static int process_timer_phydb (int argc, char **argv)
 static int process_get_rise_fall (int argc, char **argv, int dir)
 {
   TaggedTG *tg;
+  int prev = -1;
 
-  if (!std_argcheck (argc, argv, 2, "<net>", STATE_EXPANDED)) {
+  if (!std_argcheck (argc == 3 ? 2 : argc, argv, 2, "<net> [corner]", STATE_EXPANDED)) {
     return LISP_RET_ERROR;
   }
 
@@ -2402,7 +4886,14 @@ static int process_get_rise_fall (int argc, char **argv, int dir)
 
   Assert (agt, "What?");
 
+  if (argc == 3 && (prev = _corner_push (argv[0], argv[2])) == -1) {
+    return LISP_RET_ERROR;
+  }
+
   timing_info *ti = agt->queryTransition (vid, dir);
+  if (prev != -1) {
+    _corner_pop (prev);
+  }
   if (!ti) {
     fprintf (stderr, "%s: unexpected timer query failure (%s)!\n", argv[0],
 	     argv[1]);
@@ -2416,6 +4907,110 @@ static int process_get_rise_fall (int argc, char **argv, int dir)
 }
 
 
+/*
+ * Batched rise/fall query: resolve all the names first, then read the
+ * slews from the results snapshot, so there is no per-net allocation.
+ */
+static int process_get_rise_fall_list (int argc, char **argv, int dir)
+{
+  if (!std_argcheck ((argc > 2 ? 2 : argc), argv, 2, "<net1> <net2> ...",
+		     STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  Assert (agt, "What?");
+
+  int n = argc - 1;
+  int *vids;
+  MALLOC (vids, int, n);
+  for (int i=0; i < n; i++) {
+    if (!get_net_to_timing_vertex (argv[0], argv[i+1], &vids[i])) {
+      FREE (vids);
+      return LISP_RET_ERROR;
+    }
+  }
+
+  if (!_snapshot_get ()) {
+    fprintf (stderr, "%s: timing results not available\n", argv[0]);
+    FREE (vids);
+    return LISP_RET_ERROR;
+  }
+  for (int i=0; i < n; i++) {
+    if (std::isnan (tsnap.slew[vids[i] + dir])) {
+      fprintf (stderr, "%s: unexpected timer query failure (%s)!\n", argv[0],
+	       argv[i+1]);
+      FREE (vids);
+      return LISP_RET_ERROR;
+    }
+  }
+
+  LispSetReturnListStart ();
+  for (int i=0; i < n; i++) {
+    LispAppendReturnFloat (tsnap.slew[vids[i] + dir]);
+  }
+  LispSetReturnListEnd ();
+  FREE (vids);
+
+  return LISP_RET_LIST;
+}
+
+static int process_get_rise_list (int argc, char **argv)
+{
+  return process_get_rise_fall_list (argc, argv, 1);
+}
+
+static int process_get_fall_list (int argc, char **argv)
+{
+  return process_get_rise_fall_list (argc, argv, 0);
+}
+
+/*
+ * Batched slack query. The slacks come from the per-corner fork slack
+ * cache, which is filled serially: getForkSlack is not documented to
+ * be safe to call concurrently.
+ */
+static int process_timer_get_slack_list (int argc, char **argv)
+{
+  if (!std_argcheck ((argc > 2 ? 2 : argc), argv, 2, "<cid1> <cid2> ...",
+		     STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  Assert (agt, "What?");
+
+  int n = argc - 1;
+  int nc;
+  double *slk = _fork_slacks (&nc);
+  int *cids;
+  MALLOC (cids, int, n);
+  for (int i=0; i < n; i++) {
+    cids[i] = atoi (argv[i+1]);
+    if (cids[i] < 0 || cids[i] >= nc) {
+      fprintf (stderr, "%s: unknown constraint #%s\n", argv[0], argv[i+1]);
+      FREE (cids);
+      return LISP_RET_ERROR;
+    }
+  }
+
+  LispSetReturnListStart ();
+  for (int i=0; i < n; i++) {
+    LispAppendReturnFloat (slk[cids[i]]);
+  }
+  LispSetReturnListEnd ();
+
+  FREE (cids);
+  
+  return LISP_RET_LIST;
+}
+
 static int process_get_rise (int argc, char **argv)
 {
   return process_get_rise_fall (argc, argv, 1);
@@ -2451,24 +5046,390 @@ static int process_rise_fall_violations (int argc, char **argv, int dir)
 
   Assert (agt, "What?");
 
+  if (!_snapshot_get ()) {
+    return LISP_RET_ERROR;
+  }
+
   tg = agt->getTaggedTG ();
   double viol = atof (argv[1]);
   LispSetReturnListStart ();
-  for (int vid = 0; vid < tg->numVertices(); vid += 2) {
-    TimingVertexInfo *vi = (TimingVertexInfo *)
-      tg->getVertex (vid+dir)->getInfo();
-    if (vi->dummyInfo()) continue;
-    timing_info *ti = agt->queryTransition (vid, 1);
-    if (ti) {
-      if (ti->getSlew() >= viol) {
-	char *str = vi->toActId ();
-	Assert (str, "What?");
-	LispAppendReturnString (str);
-	FREE (str);
+  for (int vid = dir; vid < tsnap.nv; vid += 2) {
+    if (tsnap.slew[vid] >= viol) {
+      TimingVertexInfo *vi = (TimingVertexInfo *) tg->getVertex (vid)->getInfo();
+      char *str = vi->toActId ();
+      Assert (str, "What?");
+      LispAppendReturnString (str);
+      FREE (str);
+    }
+  }
+  LispSetReturnListEnd ();
+
+  return LISP_RET_LIST;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Monte Carlo variation of the current corner: each sample scales the
+ *  load of every net given a capacitance with set-cap by (1 + z), with
+ *  z normal with standard deviation <sigma> (clipped so the load stays
+ *  non-negative), updates timing incrementally, and records every fork
+ *  slack. Returns one (cid mean stddev min p-fail) list per constraint.
+ *  The engine does not expose the extracted load of a net, so only
+ *  loads given with set-cap can be varied.
+ *
+ *------------------------------------------------------------------------
+ */
+static int process_timer_monte_carlo (int argc, char **argv)
+{
+  if (!std_argcheck (argc == 4 ? 3 : argc, argv, 3, "<n> <sigma> [seed]",
+		     STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  int n = atoi (argv[1]);
+  double sigma = atof (argv[2]);
+  unsigned long seed = (argc == 4) ? strtoul (argv[3], NULL, 10) : 1;
+
+  if (n < 1 || sigma <= 0) {
+    fprintf (stderr, "%s: need a positive sample count and sigma\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+  save_to_log (argc, argv, "iff");
+
+  /* -- nets with a nominal load from set-cap -- */
+  int nnets = 0;
+  for (int i=0; i < A_LEN (caps); i++) {
+    if (caps[i].val > 0) {
+      nnets++;
+    }
+  }
+  if (nnets == 0) {
+    fprintf (stderr, "%s: no net capacitances set with timer:set-cap; the timer does not expose extracted net loads, so only set-cap loads can be varied\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  _cap_update ();
+
+  int nc = agt->getNumConstraints ();
+  double *sum, *sumsq, *mn;
+  int *fail;
+  MALLOC (sum, double, nc > 0 ? nc : 1);
+  MALLOC (sumsq, double, nc > 0 ? nc : 1);
+  MALLOC (mn, double, nc > 0 ? nc : 1);
+  MALLOC (fail, int, nc > 0 ? nc : 1);
+  for (int i=0; i < nc; i++) {
+    sum[i] = 0;
+    sumsq[i] = 0;
+    mn[i] = DBL_MAX;
+    fail[i] = 0;
+  }
+
+  std::mt19937 gen (seed);
+  std::normal_distribution<double> z (0.0, sigma);
+  double r_time = realtime_msec ();
+  int samples;
+
+  /*
+   * Samples share the one engine of the current corner. The slacks
+   * are read from the engine directly: the cached results stay those
+   * of the nominal run, and are invalidated once at the end.
+   */
+  for (samples = 0; samples < n && !LispInterruptExecution; samples++) {
+    for (int i=0; i < A_LEN (caps); i++) {
+      if (caps[i].val > 0) {
+	double f = 1 + z (gen);
+	agt->setCap (caps[i].vid, f > 0 ? caps[i].val*f : 0);
+      }
+    }
+    agt->incrementalUpdate ();
+
+    for (int i=0; i < nc; i++) {
+      double slk = agt->getForkSlack (i);
+      sum[i] += slk;
+      sumsq[i] += slk*slk;
+      if (slk < mn[i]) {
+	mn[i] = slk;
+      }
+      if (slk < 0) {
+	fail[i]++;
+      }
+    }
+  }
+
+  /* -- back to nominal -- */
+  for (int i=0; i < A_LEN (caps); i++) {
+    if (caps[i].val > 0) {
+      agt->setCap (caps[i].vid, caps[i].val);
+    }
+  }
+  agt->incrementalUpdate ();
+  timer_epoch++;
+
+  if (samples < n) {
+    fprintf (stderr, "%s: interrupted after %d samples\n", argv[0], samples);
+  }
+
+  int nfail = 0;
+  LispSetReturnListStart ();
+  for (int i=0; samples > 0 && i < nc; i++) {
+    double mean = sum[i]/samples;
+    double var = sumsq[i]/samples - mean*mean;
+    LispAppendListStart ();
+    LispAppendReturnInt (i);
+    LispAppendReturnFloat (mean);
+    LispAppendReturnFloat (var > 0 ? sqrt (var) : 0.0);
+    LispAppendReturnFloat (mn[i]);
+    LispAppendReturnFloat ((double)fail[i]/samples);
+    LispAppendListEnd ();
+    if (fail[i] > 0) {
+      nfail++;
+    }
+  }
+  LispSetReturnListEnd ();
+
+  printf ("%s: %d samples over %d nets in %.3f s; %d of %d constraints failed at least once\n",
+	  argv[0], samples, nnets, (realtime_msec () - r_time)/1000.0, nfail,
+	  nc);
+
+  FREE (sum);
+  FREE (sumsq);
+  FREE (mn);
+  FREE (fail);
+
+  return LISP_RET_LIST;
+}
+
+/*
+ * Distribution of one timing metric over the design: order statistics,
+ * the negative tail (for slacks), and a histogram over [min, max].
+ */
+#define TIMER_REPORT_BINS 20
+
+struct timer_dist {
+  const char *name;
+  int n;			/* number of valid values */
+  double min, p5, p50, p95, max;
+  int nneg;			/* values < 0 */
+  double tns;			/* sum of values < 0 */
+  int bins[TIMER_REPORT_BINS];
+};
+
+static void _timer_dist (const char *name, double *v, int n, timer_dist *d)
+{
+  std::vector<double> x;
+
+  d->name = name;
+  d->nneg = 0;
+  d->tns = 0;
+  for (int i=0; i < TIMER_REPORT_BINS; i++) {
+    d->bins[i] = 0;
+  }
+
+  x.reserve (n);
+  for (int i=0; i < n; i++) {
+    if (!std::isnan (v[i])) {
+      x.push_back (v[i]);
+    }
+  }
+  std::sort (x.begin(), x.end());
+
+  d->n = x.size();
+  if (d->n == 0) {
+    d->min = d->p5 = d->p50 = d->p95 = d->max = 0;
+    return;
+  }
+  d->min = x[0];
+  d->max = x[d->n-1];
+  d->p5 = x[(long)(d->n-1)*5/100];
+  d->p50 = x[(long)(d->n-1)*50/100];
+  d->p95 = x[(long)(d->n-1)*95/100];
+
+  double w = (d->max - d->min)/TIMER_REPORT_BINS;
+  for (int i=0; i < d->n; i++) {
+    int b = (w > 0) ? (int)((x[i] - d->min)/w) : 0;
+    if (b >= TIMER_REPORT_BINS) {
+      b = TIMER_REPORT_BINS-1;
+    }
+    d->bins[b]++;
+    if (x[i] < 0) {
+      d->nneg++;
+      d->tns += x[i];
+    }
+  }
+}
+
+#define TIMER_REPORT_METRICS 3
+
+static void _timer_dist_csv (FILE *fp, timer_dist *d, int n)
+{
+  fprintf (fp, "corner,metric,count,min,p5,p50,p95,max,negative,tns\n");
+  for (int c=0; c < n; c++) {
+    for (int i=0; i < TIMER_REPORT_METRICS; i++) {
+      timer_dist *x = &d[c*TIMER_REPORT_METRICS + i];
+      fprintf (fp, "%s,%s,%d,%g,%g,%g,%g,%g,%d,%g\n", corners[c].name,
+	       x->name, x->n, x->min, x->p5, x->p50, x->p95, x->max, x->nneg,
+	       x->tns);
+    }
+  }
+  fprintf (fp, "\ncorner,metric,bin_lo,bin_hi,count\n");
+  for (int c=0; c < n; c++) {
+    for (int i=0; i < TIMER_REPORT_METRICS; i++) {
+      timer_dist *x = &d[c*TIMER_REPORT_METRICS + i];
+      double w = (x->max - x->min)/TIMER_REPORT_BINS;
+      for (int j=0; x->n > 0 && j < TIMER_REPORT_BINS; j++) {
+	fprintf (fp, "%s,%s,%g,%g,%d\n", corners[c].name, x->name,
+		 x->min + j*w, x->min + (j+1)*w, x->bins[j]);
+      }
+    }
+  }
+}
+
+/*
+ * Distributions for the current corner. A net is counted once: its
+ * slack is the worse of its two transitions, and its slew the larger.
+ */
+static void _timer_dist_corner (timer_dist *d)
+{
+  int nc;
+  double *slk = _fork_slacks (&nc);
+  int nn = tsnap.nv/2;
+  double *nslack, *nslew;
+
+  MALLOC (nslack, double, nn > 0 ? nn : 1);
+  MALLOC (nslew, double, nn > 0 ? nn : 1);
+  for (int i=0; i < nn; i++) {
+    double s0 = tsnap.slack[2*i], s1 = tsnap.slack[2*i+1];
+    double w0 = tsnap.slew[2*i], w1 = tsnap.slew[2*i+1];
+    /* -- NaN marks a missing transition -- */
+    nslack[i] = std::isnan (s0) ? s1 : (std::isnan (s1) ? s0 : MIN (s0, s1));
+    nslew[i] = std::isnan (w0) ? w1 : (std::isnan (w1) ? w0 : MAX (w0, w1));
+  }
+
+  _timer_dist ("fork-slack", slk, nc, &d[0]);
+  _timer_dist ("net-slack", nslack, nn, &d[1]);
+  _timer_dist ("slew", nslew, nn, &d[2]);
+
+  FREE (nslack);
+  FREE (nslew);
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Design-wide distributions of fork slack, net slack and slew, for
+ *  every corner. Returns one list per corner: the corner name,
+ *  (wns tns violations) for its timing forks, and one
+ *  (name count min p5 p50 p95 max (bins...)) list per metric.
+ *
+ *------------------------------------------------------------------------
+ */
+static int process_timer_report (int argc, char **argv)
+{
+  FILE *fp = NULL;
+  timer_dist *d;
+
+  if (!std_argcheck (argc == 1 ? 3 : argc, argv, 3, "[-csv <file>]",
+		     STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+  if (argc == 3 && strcmp (argv[1], "-csv") != 0) {
+    fprintf (stderr, "%s: only -csv <file> supported as an argument\n",
+	     argv[0]);
+    return LISP_RET_ERROR;
+  }
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  int ncorners = A_LEN (corners);
+  int prev = cur_corner;
+  MALLOC (d, timer_dist, ncorners*TIMER_REPORT_METRICS);
+
+  /* -- the current corner last, so its snapshot is the one kept -- */
+  for (int k=1; k <= ncorners; k++) {
+    int c = (prev + k) % ncorners;
+    cur_corner = c;
+    agt = corners[c].t;
+    if (!_snapshot_get ()) {
+      _corner_pop (prev);
+      fprintf (stderr, "%s: no timing results for corner `%s'\n", argv[0],
+	       corners[c].name);
+      FREE (d);
+      return LISP_RET_ERROR;
+    }
+    _timer_dist_corner (&d[c*TIMER_REPORT_METRICS]);
+  }
+  _corner_pop (prev);
+
+  if (argc == 3) {
+    fp = std_open_output (argv[0], argv[2]);
+    if (!fp) {
+      fprintf (stderr, "%s: could not open file `%s' for writing\n",
+	       argv[0], argv[2]);
+      FREE (d);
+      return LISP_RET_ERROR;
+    }
+    _timer_dist_csv (fp, d, ncorners);
+    std_close_output (fp);
+  }
+  save_to_log (argc, argv, "ss");
+
+  LispSetReturnListStart ();
+  for (int c=0; c < ncorners; c++) {
+    timer_dist *x = &d[c*TIMER_REPORT_METRICS];
+    LispAppendListStart ();
+    LispAppendReturnString (corners[c].name);
+    LispAppendReturnFloat (x[0].nneg > 0 ? x[0].min : 0.0);
+    LispAppendReturnFloat (x[0].tns);
+    LispAppendReturnInt (x[0].nneg);
+    for (int i=0; i < TIMER_REPORT_METRICS; i++) {
+      LispAppendListStart ();
+      LispAppendReturnString (x[i].name);
+      LispAppendReturnInt (x[i].n);
+      LispAppendReturnFloat (x[i].min);
+      LispAppendReturnFloat (x[i].p5);
+      LispAppendReturnFloat (x[i].p50);
+      LispAppendReturnFloat (x[i].p95);
+      LispAppendReturnFloat (x[i].max);
+      LispAppendListStart ();
+      for (int j=0; j < TIMER_REPORT_BINS; j++) {
+	LispAppendReturnInt (x[i].bins[j]);
       }
-      delete ti;
+      LispAppendListEnd ();
+      LispAppendListEnd ();
     }
+    LispAppendListEnd ();
+  }
+  LispSetReturnListEnd ();
+  FREE (d);
+
+  return LISP_RET_LIST;
+}
+
+static int process_timer_snapshot (int argc, char **argv)
+{
+  if (!std_argcheck (argc, argv, 1, "", STATE_EXPANDED)) {
+    return LISP_RET_ERROR;
+  }
+
+  if (F.timer != TIMER_RUN) {
+    fprintf (stderr, "%s: timer needs to be run first\n", argv[0]);
+    return LISP_RET_ERROR;
+  }
+
+  if (!_snapshot_get ()) {
+    return LISP_RET_ERROR;
   }
+  save_to_log (argc, argv, "");
+
+  LispSetReturnListStart ();
+  LispAppendReturnInt (tsnap.nv);
+  LispAppendReturnInt (tsnap.M);
   LispSetReturnListEnd ();
 
   return LISP_RET_LIST;
@@ -2491,15 +5452,18 @@ static struct LispCliCommand timer_cmds[] = {
 
   { NULL, "Timing and power analysis", NULL },
   
-  { "lib-read", "<file> - read liberty timing file and return handle",
+  { "lib-read", "[-reuse] <file> - read liberty timing file and return handle; with -reuse, an unchanged file already read in this session returns the earlier handle, shared and not re-parsed (lib-merge refuses shared handles; there is no on-disk cache)",
     process_read_lib },
 
+  { "lib-read-many", "[-reuse] <file> ... - read liberty files one after the other, and return a list with one handle per file in argument order (not merged; timer:init and corner-add take several handles); no handle is created unless every file parses; -reuse as for lib-read, also for a file named twice",
+    process_read_lib_many },
+
   { "lib-merge", "<lh> <file> - merge <file> into liberty file handle <lh>",
     process_merge_lib },
 
   { "time-units", "- returns string for time units", process_lib_timeunits },
   
-  { "build-graph", "- build timing graph", process_timer_build },
+  { "build-graph", "[file] - build timing graph; apply the ticks, cuts and user constraints saved in <file> by save-graph (the graph is still built by the pass; the file only saves re-resolving the edits by name)", process_timer_build },
 
   { "tick", "<net1>+/- <net2>+/- - add a tick (iteration boundary) to the timing graph", process_timer_tick },
 
@@ -2515,6 +5479,15 @@ static struct LispCliCommand timer_cmds[] = {
   { "spef", "<file> - read in SPEF parasitics from <file>",
     process_timer_spef },
 
+  { "corner-add", "<name> <l1> <l2> ... - add a timing corner using the specified liberty handles",
+    process_timer_corner_add },
+
+  { "corner-set", "<name> - make <name> the current corner for queries (timer:init creates `default')",
+    process_timer_corner_set },
+
+  { "corner-list", "- returns list of (name current? [p M]) for all corners",
+    process_timer_corner_list },
+
 #if defined(FOUND_phydb)
   { "phydb-link",
     "- link timer to phydb for timing-driven physical design flow",
@@ -2522,7 +5495,7 @@ static struct LispCliCommand timer_cmds[] = {
   },
 #endif
 
-  { "run", "- run timing analysis, and returns list (p M)",
+  { "run", "- run timing analysis for all corners, and returns list (p M) for the current corner; after set-cap only, timing is updated incrementally; after a netlist edit, the timer is rebuilt (the engine cannot add or remove pins in place)",
     process_timer_run },
 
   { "crit", "- show critical cycle", process_timer_cycle },
@@ -2530,9 +5503,23 @@ static struct LispCliCommand timer_cmds[] = {
   { "get-fo0", "- return list of nets that have drivers but no fanout",
     process_timer_get_fo0 },
 
-  { "set-cap", "<net> <val> - add capacitance to the specified net",
+  { "set-cap", "<net> <val> - set the additional capacitance on <net>, replacing any earlier set-cap value",
     process_timer_setcap },
 
+  { "perf-tag-add", "<corner> <target> [weight] - add a cycle time target for <corner> for timing-driven placement; returns its id",
+    process_timer_perf_add },
+  { "perf-tag-list", "- list performance tags as (corner target weight slack)",
+    process_timer_perf_list },
+
+  { "whatif-begin", "- start a what-if sandbox; set-cap changes can be rolled back, while netlist edits (cell swaps, buffers) and tick/cut edits are refused until it is closed",
+    process_timer_whatif_begin },
+  { "whatif-commit", "- keep the changes made in the what-if sandbox",
+    process_timer_whatif_commit },
+  { "whatif-abort", "- undo the set-cap changes made in the what-if sandbox",
+    process_timer_whatif_abort },
+  { "whatif-eval", "<net> <val> ... - worst fork slack with each capacitance change applied on its own",
+    process_timer_whatif_eval },
+
   { "info", "<net> - display information about the net",
     process_timer_info },
 
@@ -2542,16 +5529,22 @@ static struct LispCliCommand timer_cmds[] = {
   { "constraint", "[<net>] - display information about all timing forks that involve <net>",
     process_timer_constraint },
 
+  { "constraints-of", "<net> ... - return, for each net, the list of timing fork constraint ids (timer cids, as for get-slack) that involve it",
+    process_timer_constraints_of },
+
   { "num-constraints", "- returns the number of constraints in the design",
     process_timer_num_constraints },
 
-  { "get-violations", "- returns a list of constraint ids (cids) that have violations",
+  { "get-violations", "[k] - returns a list of (cid slack) for violated constraints, worst first (at most k); with several corners, the slack is the worst over all corners",
     process_timer_get_violations },
 
   { "check-constraint", "cid [ticks] - does a path analysis to check paths for timing fork #<cid> exist",
     process_timer_check_constraint },
 
-  { "get-slack", "cid - returns the slack of the violating constraint id #cid",
+  { "check-all-constraints", "[ticks] - checks the paths for all timing forks in parallel; returns list of failures (cid lhs-status lhs-ticks rhs-status rhs-ticks), status is ok/unreachable/ticks",
+    process_timer_check_all_constraints },
+
+  { "get-slack", "cid [corner] - returns the slack of the violating constraint id #cid",
     process_timer_get_slack },
 
 #if defined(FOUND_phydb)  
@@ -2559,12 +5552,30 @@ static struct LispCliCommand timer_cmds[] = {
     process_timer_get_witness },
 #endif
 
-  { "get-rise", "<net> - returns rise time for <net>",
+  { "get-rise", "<net> [corner] - returns rise time for <net>",
     process_get_rise },
 
-  { "get-fall", "<net> - returns fall time for <net>",
+  { "get-fall", "<net> [corner] - returns fall time for <net>",
     process_get_fall },
   
+  { "get-rise-list", "<net1> <net2> ... - returns list of rise times for the nets",
+    process_get_rise_list },
+
+  { "get-fall-list", "<net1> <net2> ... - returns list of fall times for the nets",
+    process_get_fall_list },
+
+  { "get-slack-list", "<cid1> <cid2> ... - returns list of slacks for the constraint ids, computed serially",
+    process_timer_get_slack_list },
+  
+  { "snapshot", "- capture slew/arrival/required/slack for all timing vertices; returns (#vertices M). Bulk scans use the snapshot automatically",
+    process_timer_snapshot },
+
+  { "monte-carlo", "<n> <sigma> [seed] - <n> samples of the current corner with the set-cap loads varied by a relative std. deviation <sigma>; returns (cid mean stddev min p-fail) per constraint; only set-cap loads are varied, as the timer does not expose extracted net loads",
+    process_timer_monte_carlo },
+
+  { "report", "[-csv <file>] - for each corner, a list (corner wns tns violations fork-slack net-slack slew): wns/tns/violations of the timing forks, then the distribution (name count min p5 p50 p95 max (bins...)) of each metric; a net counts once, with its worst transition",
+    process_timer_report },
+
   { "rise-violations", "<time> - returns a list of drivers that have rise time worse than <time> in timer units",
     process_rise_violations },
     
@@ -2572,7 +5583,10 @@ static struct LispCliCommand timer_cmds[] = {
     process_fall_violations },
 
   { "save", "<file> - save abstract timing graph to file in graphviz format",
-    process_timer_save }
+    process_timer_save },
+
+  { "save-graph", "<file> - save the ticks, cuts and constraints of the timing graph in a portable text file, for build-graph (the graph itself is rebuilt by build-graph)",
+    process_timer_save_graph }
 
 };
 